@@ -0,0 +1,98 @@
+#pragma once
+
+#include "RenderContext.h"
+#include "Compositor.h"
+
+// How a sprite of the content table behaves
+enum Motion : uint8_t {
+  MOTION_POP,   // Appears on a free spot and disappears again, the original hearts
+  MOTION_DRIFT, // Moves at a constant speed and bounces off the edges of the area
+  MOTION_GLIDE  // Eases from one random spot of the area to the next
+};
+
+enum Easing : uint8_t {
+  EASE_LINEAR,
+  EASE_OUT,    // Fast start, slow finish
+  EASE_IN_OUT  // Slow start and finish
+};
+
+// One row of the content table: count copies of a sprite moving the same way
+struct AnimationSpec {
+  const char *spritePath; // BMP file, the atlas sprite of the same name is used when there is one
+  uint8_t     count;
+  Motion      motion;
+  uint16_t    speed;    // MOTION_DRIFT, pixels per second
+  uint16_t    duration; // MOTION_POP: time between two pops, MOTION_GLIDE: time per move, in milliseconds
+  Easing      easing;   // MOTION_GLIDE
+};
+
+// Animates the sprites of a content table on a compositor with a fixed
+// time step. The scheduler calls frame() every frameTime; frame() runs
+// as many fixed steps as the time that really passed asks for, capped
+// so a slow frame drops updates instead of snowballing, then redraws
+// whatever moved. Achieved FPS and the worst frame time are reported
+// over Serial every statsInterval.
+class Animation {
+public:
+  static const uint32_t frameTime     = 33;   // Fixed time step, 30 FPS, keep patternFrameTime the same
+  static const uint8_t  maxCatchUp    = 3;    // Steps run by one frame at most
+  static const uint32_t statsInterval = 5000; // How often the frame stats are printed, in milliseconds
+  static const uint8_t  maxSpecs      = 8;
+  static const uint8_t  maxActors     = 32;
+  static const uint8_t  maxCells      = 64;
+
+  Animation(Compositor &compositor, SpriteCache &sprites);
+
+  // Loads the sprites of the table and places them. Popping sprites share
+  // a grid over popArea, with cells cellGap pixels larger than the sprite
+  // so they never overlap. Moving sprites roam the whole screen.
+  void begin(RenderContext &ctx, const AnimationSpec *specs, uint8_t specCount,
+             const Rect &popArea, uint16_t cellGap);
+  void frame(RenderContext &ctx);
+
+private:
+  struct Actor {
+    const AnimationSpec *spec;
+    int8_t   layer;
+    uint16_t width, height;
+    int32_t  x, y;           // Position in 1/256 pixel
+    int32_t  vx, vy;         // MOTION_DRIFT, 1/256 pixel per step
+    int16_t  fromX, fromY;   // MOTION_GLIDE, current move
+    int16_t  toX, toY;
+    uint32_t elapsed;        // MOTION_GLIDE, time into the current move
+    uint8_t  cell;           // MOTION_POP, grid cell while on screen
+  };
+
+  void step();
+  void stepPop(uint8_t specIndex);
+  void stepActor(Actor &actor);
+  void newGlide(Actor &actor);
+  uint8_t takeFreeCell();
+  void releaseCell(uint8_t cell);
+  void reportStats();
+
+  Compositor  &compositor;
+  SpriteCache &sprites;
+  const AnimationSpec *specs;
+  uint8_t      specCount;
+  uint32_t     popTimers[maxSpecs];  // Per table row, time since the last pop
+  uint8_t      firstActor[maxSpecs]; // Per table row, its first actor
+  Actor        actors[maxActors];
+  uint8_t      actorCount;
+  Rect         screen;
+  Rect         popArea;
+
+  // Grid of the popping sprites
+  uint8_t      gridCols, gridRows;
+  uint16_t     cellWidth, cellHeight, cellGap;
+  bool         cellUsed[maxCells];
+  uint8_t      freeCells;
+
+  // Fixed time step bookkeeping and frame stats
+  uint32_t     lastFrame;
+  uint32_t     pending;       // Time not yet simulated, in milliseconds
+  uint32_t     statsStart;
+  uint16_t     frames;
+  uint16_t     droppedSteps;
+  uint32_t     worstFrameUs;
+};
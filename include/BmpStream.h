@@ -0,0 +1,133 @@
+#pragma once
+
+#include "RenderContext.h"
+#include "ImageFile.h"
+
+// Raw .565 files start with this magic ("R565"), then the width and height as
+// little endian 16 bit values, followed by top down rows of big endian RGB565
+// pixels, the byte order the display expects
+const uint32_t raw565Magic      = 0x35363552;
+const uint32_t raw565HeaderSize = 8;
+
+// Fields of a BMP (or .565) header needed to stream its pixels to the display
+struct BmpHeader {
+  int32_t  width;
+  int32_t  height;
+  uint32_t pixelOffset; // Where the pixel rows start in the file
+  uint32_t rowSize;     // Bytes per row in the file, including padding
+  uint16_t depth;       // Bits per pixel
+  bool     bottomUp;    // Rows are stored from the bottom of the image up
+  bool     rgb555;      // 16 bit images only, 5 bits for green instead of 6
+  bool     raw565;      // Raw .565 file, pixels are already in display byte order
+};
+
+// Part of a BMP that ends up on the screen once it is clipped
+struct BmpLayout {
+  int16_t  x, y;               // Top left corner of the visible part on the screen
+  uint16_t width, height;      // Visible size
+  uint16_t firstCol, firstRow; // First visible column and row of the image
+  uint32_t spanStart;          // Offset of the visible columns inside a file row
+  uint32_t spanBytes;          // Bytes to read from each file row
+  uint8_t  scale;              // Image pixels per screen pixel each way, 1 unless downscaled
+};
+
+// Largest integer factor oversized images are shrunk by, anything bigger
+// than the screen at this scale gets cropped
+const uint8_t maxBmpScale = 4;
+
+// Parses the header of an already opened BMP file, supports uncompressed
+// 1/4/8 bit palette, 16 bit and 24 bit images as well as raw .565 files
+ImageReturnCode readBmpHeader(ImageFile file, BmpHeader &header);
+
+// Streams an already opened BMP file to the display with its top left
+// corner at x,y. The file is never reopened and its header is read once.
+ImageReturnCode drawBmp(RenderContext &ctx, ImageFile file, int16_t x, int16_t y);
+
+// Same as drawBmp() but centers the image on the screen using the
+// dimensions from the header it already read. Images bigger than the
+// screen are shrunk to fit unless downscaling is turned off.
+ImageReturnCode drawBmpCentered(RenderContext &ctx, ImageFile file);
+
+// Long draws check this flag between blocks and stop early when it is set,
+// leaving the picture partly drawn. NULL (the default) never stops.
+void setBmpAbortFlag(volatile bool *flag);
+bool bmpAbortRequested();
+
+// Box filter oversized images down when centering them (on by default)
+void setBmpDownscale(bool enabled);
+// Smallest integer factor, up to maxBmpScale, that fits the image on the screen
+uint8_t bmpFitScale(RenderContext &ctx, const BmpHeader &header);
+
+// Clips an image placed at x,y to the screen, false when none of it is visible
+bool layoutBmp(RenderContext &ctx, const BmpHeader &header, int16_t x, int16_t y, BmpLayout &layout);
+// Same as layoutBmp() with any region of the screen instead of the whole screen.
+// With a scale above 1 the image is drawn that many times smaller and x,y
+// place the scaled image.
+bool clipBmp(const BmpHeader &header, int16_t x, int16_t y,
+             int16_t clipX, int16_t clipY, int16_t clipW, int16_t clipH, BmpLayout &layout, uint8_t scale = 1);
+// Centers the image on the screen, shrunk by bmpFitScale()
+bool layoutBmpCentered(RenderContext &ctx, const BmpHeader &header, BmpLayout &layout);
+
+// Reads up to maxRows visible rows starting at row (counted from the top of the
+// layout) and converts them to RGB565 into out. Rows are read in one block
+// unless most of each row is off screen or the layout is downscaled.
+// Pixels of .565 files are left big endian.
+// Returns how many rows were read, 0 on a read error.
+uint16_t readBmpRows(ImageFile file, const BmpHeader &header, const BmpLayout &layout, uint16_t row, uint16_t maxRows, uint16_t *out);
+
+// Pixel bytes readBmpRows() took from files since boot, skipped spans and
+// rows not included. A running total, callers take the difference.
+uint32_t bmpBytesRead();
+
+// Converts count pixels of a raw file row to RGB565, starting at column
+// firstCol of src for palette images and at src itself for 16 and 24 bit
+// ones. Palette images use the palette of the last header read.
+void convertBmpRow(const BmpHeader &header, const uint8_t *src, uint16_t firstCol, uint16_t count, uint16_t *out);
+
+// Decodes the top rows of the next slideshow image into RAM while the current
+// one is still on screen, so the transition starts with a single SPI push
+// instead of waiting on the card. RAM can't hold a whole frame, rows that
+// don't fit in the buffer are streamed from the card when the image is drawn.
+// The buffer comes from the arena's prefetch pool.
+class BmpPrefetch {
+public:
+  static const size_t minBufferBytes = 2048;
+
+  BmpPrefetch();
+
+  // Takes the row buffer from the arena, smaller when the sprites left less
+  // room. False when not even minBufferBytes fit, images then load on display.
+  bool begin(size_t bufferBytes);
+  // Gives the buffer back, forgetting the image being read ahead
+  void end();
+  // Parses the header of the next image and gets ready to decode it.
+  // The file must stay open until draw() returns.
+  void start(RenderContext &ctx, ImageFile next);
+  // Decodes up to rows more rows, returns true once the buffer is full
+  bool step(uint16_t rows);
+  bool done() const { return !file.isOpen()||rowsReady>=rowCapacity; }
+  // Pushes the decoded rows and streams the rest of the image
+  ImageReturnCode draw(RenderContext &ctx);
+  // Writes screen rows [y, y+rows) at full width instead, with background
+  // around the picture. Bands can go in any order, call finish() after the
+  // last one in place of draw().
+  ImageReturnCode drawRows(RenderContext &ctx, int16_t y, uint16_t rows, uint16_t background);
+  void finish();
+
+  // Timing of the last draw() in milliseconds
+  uint32_t swapTime;       // Pushing the prefetched rows
+  uint32_t drawTime;       // The whole image
+  uint16_t prefetchedRows;
+  uint32_t bytesRead;      // Pixel bytes of the image read so far, the prefetch included
+
+private:
+  uint16_t       *buffer;
+  size_t          capacity;
+  ImageFile       file;
+  BmpHeader       header;
+  BmpLayout       layout;
+  ImageReturnCode status;
+  bool            visible;
+  uint16_t        rowCapacity;
+  uint16_t        rowsReady;
+};
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Mode change button. The interrupt does the debouncing and queues a
+// timestamp for every press, so presses are neither lost while a mode is
+// busy nor counted twice because of contact bounce.
+
+const uint32_t buttonQuietTime = 30; // The line must be still this long before a new press counts, in milliseconds
+const uint8_t  buttonQueueSize = 8;  // Presses that can wait to be handled
+
+// Set by the interrupt on every press. Long running work (drawing a
+// picture, searching for a sprite spot) checks it and stops early so the
+// press is handled within a bounded time. Cleared once the press is handled.
+extern volatile bool renderAbort;
+
+// Sets up the pin and the interrupt, the button pulls the pin low
+void buttonBegin(uint8_t pin);
+// Sets the interrupt up again after a light sleep used the pin to wake
+// up, and queues the press that did it when the button is still down
+void buttonResume();
+// Takes the oldest queued press, false when there are none
+bool buttonPopPress(uint32_t &pressedAt);
+// True while presses are queued
+bool buttonPending();
+// Presses lost because the queue was full
+uint16_t buttonDroppedPresses();
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "RenderContext.h"
+#include "SpriteCache.h"
+#include "BmpStream.h"
+
+// A screen region
+struct Rect {
+  int16_t x, y, w, h;
+};
+
+// What the sprites are drawn over
+struct Background {
+  uint16_t color; // Solid background color
+  int8_t   tile;  // Cached sprite repeated over the screen, -1 for a solid color
+};
+
+// Draws sprite layers over a background by only redrawing the regions that
+// changed. Moving, showing or hiding a layer marks its old and new boxes as
+// dirty, overlapping dirty boxes are merged, and flush() composes each box
+// in RAM (background, then an optional picture from the card, then the
+// layers in order with keyColor pixels left transparent) before pushing it
+// to the display in one go. SPI traffic follows what actually changed.
+class Compositor {
+public:
+  static const uint8_t  maxLayers   = 32;
+  static const uint8_t  maxDirty    = 12;
+  static const uint16_t stripPixels = 1024; // Size of the composition buffer
+
+  Compositor(SpriteCache &sprites);
+
+  // Starts over with no layers and the whole screen dirty
+  void begin(RenderContext &ctx, const Background &bg, uint16_t keyColor);
+  // Picture composed between the background and the layers, read from the
+  // card wherever a dirty box overlaps it. The file must stay open.
+  bool setBackdrop(ImageFile file, int16_t x, int16_t y);
+
+  // Adds a layer drawn with the given sprite, returns its id or -1
+  int8_t addLayer(int8_t sprite, int16_t x, int16_t y, bool visible);
+  void moveLayer(int8_t id, int16_t x, int16_t y);
+  void showLayer(int8_t id, bool visible);
+  bool isVisible(int8_t id) const;
+  void markDirty(int16_t x, int16_t y, int16_t w, int16_t h);
+
+  // Composes and pushes every dirty region
+  void flush(RenderContext &ctx);
+
+  uint32_t pushedPixels; // Pixels sent to the display since begin()
+
+private:
+  struct Layer {
+    int8_t  sprite;
+    int16_t x, y;
+    bool    visible;
+  };
+
+  void markLayer(const Layer &layer);
+  void compose(RenderContext &ctx, const Rect &rect, int16_t y, int16_t rows);
+
+  SpriteCache &sprites;
+  Background   background;
+  uint16_t     keyColor;
+  int16_t      screenWidth, screenLength;
+  Layer        layers[maxLayers];
+  uint8_t      layerCount;
+  Rect         dirty[maxDirty];
+  uint8_t      dirtyCount;
+
+  ImageFile    backdrop;
+  BmpHeader    backdropHeader;
+  int16_t      backdropX, backdropY;
+};
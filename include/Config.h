@@ -0,0 +1,68 @@
+#pragma once
+
+#include <SdFat.h>
+#include "Animation.h"
+#include "ImageIndex.h"
+#include "Transition.h"
+#include "Power.h"
+
+// Settings read from a text file in the root of the SD card, so the
+// slideshow and the pattern can be changed without reflashing. The file
+// is parsed once at boot into a DeviceConfig, a fixed size struct with
+// no heap strings, and nothing reads it again after that. Missing
+// settings, or a missing file, keep the values the device was built with.
+//
+// One setting per line, "#" starts a comment, lists are comma separated:
+//   mode       = slideshow        # Mode shown after boot, slideshow or pattern
+//   dir        = /                # Directory of the slideshow pictures
+//   cadence    = 4000             # Time between two pictures, in milliseconds
+//   transition = push-up          # none, wipe, push-up or push-down
+//   downscale  = yes              # Shrink pictures bigger than the screen
+//   convert    = yes              # Write .565 copies of the pictures at boot
+//   flash      = yes              # Keep copies of the assets in flash
+//   frame      = 33               # Pattern redraw period, 33 to 99 milliseconds
+//   sprite     = /pattern/heart.bmp, 24, pop, 0, 500, linear
+//                                 # Pattern content row: file, count, pop/drift/glide,
+//                                 # speed, duration, linear/out/in-out
+//   show       = beach.bmp, 8000  # Playlist entry: file name, optional time on screen
+//   wifi       = network, secret  # Joins the network to take pictures pushed over HTTP
+//   power      = save             # full, or save to sleep between deadlines on a battery
+//   backlight  = 60               # Brightness in percent, needs a TFT_LED pin
+//   sleep      = 30               # Minutes without a press before the display sleeps, 0 never
+// With sprite lines the pattern shows those rows instead of its built in
+// content. With show lines the slideshow only shows the listed pictures,
+// in the order they are listed.
+
+const char * const configPath = "/config.txt";
+const uint8_t configPathMax   = 32; // Longest directory or sprite path, with its terminator
+const uint8_t configLineMax   = 96; // Longer lines are cut off
+const uint8_t wifiSsidMax     = 33; // 32 characters and the terminator
+const uint8_t wifiPasswordMax = 65;
+
+struct DeviceConfig {
+  char       rootDir[configPathMax];
+  uint8_t    startMode;        // 0 slideshow, 1 pattern
+  uint32_t   slideshowTime;    // Cadence of the slideshow, in milliseconds
+  Transition transition;
+  bool       downscale;
+  bool       convertTo565;
+  bool       copyToFlash;
+  uint32_t   patternFrameTime;
+  uint8_t    specCount;        // Pattern content rows, 0 keeps the built in table
+  AnimationSpec specs[Animation::maxSpecs];
+  char       spritePaths[Animation::maxSpecs][configPathMax]; // What the specs point to
+  Playlist   playlist;
+  char       wifiSsid[wifiSsidMax]; // Empty keeps Wi-Fi off
+  char       wifiPassword[wifiPasswordMax];
+  PowerMode  powerMode;
+  uint8_t    backlight;        // Percent
+  uint16_t   sleepMinutes;     // 0 keeps the display on
+};
+
+// The values the device was built with
+void configDefaults(DeviceConfig &config);
+// Reads the config file over the defaults, false when there is no file.
+// Lines that can't be understood are reported and skipped.
+bool loadConfig(SdFat &sd, const char *path, DeviceConfig &config);
+// Prints the settings in use
+void printConfig(Print &out, const DeviceConfig &config);
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "RenderContext.h"
+#include <LittleFS.h>
+
+// Copies of the assets that matter most are kept in LittleFS on the
+// NodeMCU's own flash (2 MB with the 4m2m layout): the pattern sprite
+// atlas and message, and the first few .565 slideshow pictures. Flash
+// reads don't share the SPI bus with the display and need no FAT lookup,
+// so pattern mode loads from flash first. And when the SD card is missing
+// the slideshow still has something to show.
+// Flash copies keep the path of the SD file, the slides are numbered.
+
+const uint8_t flashSlideCount = 4; // Pictures copied to flash, 150 KB each at full screen
+const char * const flashSlidePath = "/slides/%u.565";
+const char * const flashAssets[] = {"/pattern/sprites.atl", "/pattern/bottom-message.bmp"};
+const uint8_t flashAssetCount = sizeof(flashAssets)/sizeof(flashAssets[0]);
+
+// Mounts the flash file system, formatting it the first time
+bool flashBegin();
+bool flashReady();
+// Copies the assets and the .565 pictures of the directory to flash.
+// Only files that changed on the card since the last sync are copied.
+void flashSync(RenderContext &ctx, const char *dirName);
+// Opens the flash copy of an SD file, check the result before use
+fs::File flashOpen(const char *path);
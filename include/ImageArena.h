@@ -0,0 +1,46 @@
+#pragma once
+
+#include <Arduino.h>
+
+// One static block of RAM for the big image buffers, sized at build time
+// with -D IMAGE_ARENA_SIZE in platformio.ini, so they don't compete with
+// Wi-Fi and the libraries for the heap and can't fragment it. The arena
+// is split into pools that hand out blocks one after the other and take
+// them all back at once, with no malloc() while the device runs:
+//   sprites, prefetch  share the image area, sprites from the bottom and
+//                      the prefetch buffer from the top, so a bigger set
+//                      of sprites leaves a smaller prefetch buffer and
+//                      the other way around
+//   rows               scratch rows of the .565 conversion and of the
+//                      pictures pushed over Wi-Fi, never both at once
+// A pool that runs out returns NULL and its user carries on with less:
+// the prefetch buffer shrinks or turns off, sprites that don't fit are
+// left out. The split and the high-water marks are printed at boot and
+// when 'a' is sent over the serial monitor.
+
+#ifndef IMAGE_ARENA_SIZE
+#define IMAGE_ARENA_SIZE 28672
+#endif
+
+const size_t arenaSize     = IMAGE_ARENA_SIZE;
+const size_t arenaRowBytes = 3072; // The rows pool, the rest is the image area
+
+enum ArenaPool : uint8_t {
+  POOL_SPRITES,
+  POOL_PREFETCH,
+  POOL_ROWS,
+  POOL_COUNT
+};
+
+// A 4 byte aligned block, NULL when the pool can't fit it
+void *arenaTake(ArenaPool pool, size_t bytes);
+// Room for count values of T
+template<typename T> T *arenaTake(ArenaPool pool, size_t count){
+  return (T *)arenaTake(pool,count*sizeof(T));
+}
+// Biggest block the pool could give right now
+size_t arenaAvailable(ArenaPool pool);
+// Takes back every block of the pool, so a pool has a single user
+void arenaRelease(ArenaPool pool);
+// Prints the split, what every pool holds, its high-water mark and failed requests
+void arenaReport(Print &out);
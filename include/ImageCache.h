@@ -0,0 +1,28 @@
+#pragma once
+
+#include "RenderContext.h"
+
+// Pictures can be cached on the SD card as raw .565 files next to the
+// original .bmp ("photo.bmp" -> "photo.565"). They hold display-native
+// pixels so the slideshow can stream them without any per pixel work.
+// After the pixels a copy records the size and modification stamp of the
+// BMP it was made from, any difference makes it stale.
+
+// True when the file name ends in the given extension, ignoring case
+bool hasExtension(const char *name, const char *ext);
+
+// Replaces the extension of name with ext, false if it doesn't fit in size
+bool swapExtension(char *name, size_t size, const char *ext);
+
+// Writes a .565 copy of every BMP in the directory that doesn't have an up
+// to date one yet. Pictures larger than the screen are stored shrunk to fit
+// (see bmpFitScale()), ones that still don't fit are left as BMPs.
+// Meant to run once at boot, the first boot after adding pictures is slow.
+void convertImagesTo565(RenderContext &ctx, const char *dirName);
+
+// Opens the cached .565 copy of a BMP directory entry into cache when it
+// exists and was made from the BMP as it is now
+bool openCachedImage(File32 &dir, File32 &entry, File32 &cache);
+
+// True for a .565 file that is the cached copy of a BMP in the same directory
+bool isCacheOfBmp(File32 &dir, File32 &entry);
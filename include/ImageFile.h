@@ -0,0 +1,39 @@
+#pragma once
+
+#include <SdFat.h>
+#include <FS.h>
+
+// Either an SD card file or a LittleFS file, so the picture streamers can
+// read from the card and from the flash alike. It only points at a file
+// opened somewhere else and is passed around by value, the file must stay
+// open for as long as the ImageFile is used.
+class ImageFile {
+public:
+  ImageFile() : sd(NULL), flash(NULL) {}
+  ImageFile(File32 &file) : sd(&file), flash(NULL) {}
+  ImageFile(fs::File &file) : sd(NULL), flash(&file) {}
+
+  bool isOpen() const { return sd ? sd->isOpen() : flash&&*flash; }
+  bool isFile() const { return sd ? sd->isFile() : flash&&*flash&&flash->isFile(); }
+  bool onFlash() const { return flash!=NULL; }
+
+  int read(void *buffer, size_t count){
+    return sd ? sd->read(buffer,count) : flash ? (int)flash->read((uint8_t *)buffer,count) : -1;
+  }
+  int read(){
+    return sd ? sd->read() : flash ? flash->read() : -1;
+  }
+  bool seekSet(uint32_t position){
+    return sd ? sd->seekSet(position) : flash&&flash->seek(position,SeekSet);
+  }
+  bool seekCur(int32_t offset){
+    return sd ? sd->seekCur(offset) : flash&&flash->seek(offset,SeekCur);
+  }
+  uint32_t fileSize() const {
+    return sd ? sd->fileSize() : flash ? flash->size() : 0;
+  }
+
+private:
+  File32   *sd;
+  fs::File *flash;
+};
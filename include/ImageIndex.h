@@ -0,0 +1,84 @@
+#pragma once
+
+#include "RenderContext.h"
+#include "ImageFile.h"
+#include <FS.h>
+
+// How a picture is decoded, chosen from its extension
+enum PictureFormat : uint8_t {
+  FORMAT_BMP,  // .bmp and .565, streamed by BmpStream
+  FORMAT_JPEG  // .jpg and .jpeg, decoded by JpegStream
+};
+
+// Pictures to show and for how long, in the order to show them. Names are
+// matched against the files of the directory without minding case.
+const uint8_t playlistMax     = 32;
+const uint8_t playlistNameMax = 32;
+
+struct PlaylistItem {
+  char     name[playlistNameMax];
+  uint32_t showTime; // Milliseconds on screen, 0 for the slideshow cadence
+};
+
+struct Playlist {
+  uint8_t      count;
+  PlaylistItem items[playlistMax];
+};
+
+// One displayable picture of the slideshow directory
+struct ImageIndexEntry {
+  uint16_t      dirIndex;   // Position of the file in its directory
+  uint16_t      cacheIndex; // Position of its .565 copy, noCache when there isn't one
+  uint16_t      width;      // Picture dimensions from the header
+  uint16_t      height;
+  PictureFormat format;
+  bool          slow;     // Takes too long to draw for the slideshow cadence
+  uint16_t      drawTime; // Last measured draw time in milliseconds, 0 until shown
+  uint8_t       playlistSlot; // Its playlist item, notListed without a playlist
+};
+
+// In-RAM list of the valid pictures of a directory, built by one scan at
+// boot. Pictures are opened by their directory position so no names or
+// path lookups are involved, and anything that isn't a readable image
+// never makes it into the list.
+// An index can also be built over the slides kept in flash, for when
+// there is no SD card.
+class ImageIndex {
+public:
+  static const uint16_t maxImages = 256;
+  static const uint16_t noCache   = 0xFFFF;
+  static const uint8_t  notListed = 0xFF;
+
+  ImageIndex();
+
+  // Scans the directory, returns the number of pictures found. With a
+  // playlist only the pictures it lists are kept, in its order. The
+  // playlist must outlive the index.
+  uint16_t build(RenderContext &ctx, const char *dirName, const Playlist *playlist = NULL);
+  // Lists the slides copied to flash by flashSync() instead
+  uint16_t buildFromFlash();
+  bool onFlash() const { return flash; }
+  uint16_t count() const { return imageCount; }
+  const ImageIndexEntry &entry(uint16_t i) const { return entries[i]; }
+  // How long picture i stays on screen from its playlist, 0 when it isn't set
+  uint32_t showTime(uint16_t i) const;
+  // Measurements from the slideshow, kept for as long as the index
+  void setDrawTime(uint16_t i, uint16_t ms) { entries[i].drawTime = ms; }
+  void flagSlow(uint16_t i, bool slow) { entries[i].slow = slow; }
+  // Opens picture i, or its .565 copy when it has one. The index holds the
+  // open file, opening another picture or close() closes it.
+  ImageFile open(uint16_t i);
+  void close();
+
+  uint16_t next(uint16_t i) const { return i+1<imageCount ? i+1 : 0; }
+  uint16_t previous(uint16_t i) const { return i>0 ? i-1 : imageCount-1; }
+
+private:
+  File32          dir;
+  File32          current;      // Open picture on the card
+  fs::File        currentFlash; // Or in flash
+  ImageIndexEntry entries[maxImages];
+  const Playlist *playlist;
+  uint16_t        imageCount;
+  bool            flash;
+};
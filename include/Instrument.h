@@ -0,0 +1,50 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Timing probes around the hot paths, measured in CPU cycles with
+// ESP.getCycleCount() so a probe costs a few instructions. Every probe
+// keeps a log2 histogram and a ring of its most recent samples, printed
+// when 'i' is sent over the serial monitor. Built only with
+// -D ENABLE_INSTRUMENTATION, otherwise every probe compiles to nothing.
+
+enum Probe : uint8_t {
+  PROBE_SD_OPEN,     // Opening a picture from the index
+  PROBE_HEADER,      // Parsing a picture header
+  PROBE_PIXEL_READ,  // Reading a block of pixel rows from the card
+  PROBE_SPI_PUSH,    // Pushing pixels to the display
+  PROBE_CELL_SEARCH, // Finding a free spot for a popping sprite
+  PROBE_COMPOSE,     // Composing a dirty region in RAM
+  PROBE_COUNT
+};
+
+#ifdef ENABLE_INSTRUMENTATION
+
+const uint8_t probeBuckets    = 24; // Histogram bucket n holds samples of 2^n to 2^(n+1)-1 cycles
+const uint8_t probeRecentSize = 16; // Most recent samples kept per probe
+
+void instrumentRecord(Probe probe, uint32_t cycles);
+// Prints count, min/avg/max, the histogram and the recent samples of every probe
+void instrumentDump(Print &out);
+void instrumentReset();
+
+// Times the scope it is declared in
+class ProbeTimer {
+public:
+  ProbeTimer(Probe probe) : probe(probe), start(ESP.getCycleCount()) {}
+  ~ProbeTimer() { instrumentRecord(probe,ESP.getCycleCount()-start); }
+private:
+  Probe    probe;
+  uint32_t start;
+};
+
+#define INSTRUMENT_SCOPE(probe) ProbeTimer probeTimer(probe)
+
+#else
+
+inline void instrumentDump(Print &out) { out.println(F("Built without ENABLE_INSTRUMENTATION")); }
+inline void instrumentReset() {}
+
+#define INSTRUMENT_SCOPE(probe) do {} while(0)
+
+#endif
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "RenderContext.h"
+#include "ImageFile.h"
+
+// Baseline JPEG pictures are decoded with JPEGDEC one strip of MCUs at a
+// time, each strip going straight to the display. A 240x320 photo is
+// usually 15-30 KB on the card against 230 KB for the same BMP, so far
+// fewer bytes are read per picture at the cost of decoding them.
+// The decoder needs about 17 KB of RAM, it is only allocated once a JPEG
+// is drawn and then kept, mode switches don't free it.
+
+// Reads the dimensions of a baseline JPEG from its frame header, false for
+// anything the decoder can't handle (progressive files included)
+bool readJpegSize(ImageFile file, uint16_t &width, uint16_t &height);
+
+// Decodes an already opened JPEG to the center of the screen. Pictures
+// larger than the screen are scaled down by 2, 4 or 8 until they fit, the
+// screen around smaller ones is filled with background first.
+ImageReturnCode drawJpegCentered(RenderContext &ctx, ImageFile file, uint16_t background);
+
+// Bytes read from the card by the last drawJpegCentered()
+uint32_t jpegBytesRead();
+
+// Frees the decoder, only for the benchmarks
+void jpegRelease();
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "RenderContext.h"
+#include "Scheduler.h"
+#include "ImageArena.h"
+
+// What a mode does when it is switched to and away from. Only enter and
+// exit are required.
+struct ModeHooks {
+  const char *name;
+  void   (*enter)(RenderContext &ctx);  // Draws the mode's first screen, its tasks start right after
+  void   (*exit)();                     // Its tasks are already stopped, keeps what it loaded
+  bool   (*warm)(RenderContext &ctx);   // Loads a bit of what enter() needs ahead of time, true once done
+  void   (*release)();                  // Frees everything the mode loaded
+  ArenaPool warmPool;                   // Arena pool its buffers come from
+  size_t warmBytes;                     // Bytes it holds in that pool while it isn't shown
+};
+
+// Registry of the modes the button cycles through. Every mode owns a few
+// scheduler tasks that only run while it is shown. Switching modes stops
+// those tasks, runs the hooks and starts the new mode's tasks.
+// To make switching quick the mode after the current one is kept loaded:
+// a mode that was just left stays as it is when it comes next, otherwise
+// the warm-up task loads it a little at a time once the new mode is on
+// screen. Only one mode is kept warm, and only when its warmBytes fit in
+// the budget and are still free in its arena pool. Everything else is
+// released.
+class ModeManager {
+public:
+  static const uint8_t  maxModes     = 4;
+  static const uint8_t  maxModeTasks = 2;
+  static const uint32_t warmDelay    = 1000; // Time after a switch before warming starts, in milliseconds
+
+  ModeManager(Scheduler &scheduler, size_t warmBudget);
+
+  // Registers a mode, returns its id or -1 when the table is full
+  int8_t add(const ModeHooks &hooks);
+  // Task started and stopped with the mode
+  void addTask(int8_t mode, int8_t taskId);
+  // Task that calls warmStep(), the manager schedules it
+  void setWarmTask(int8_t taskId) { warmTask = taskId; }
+
+  // Shows a mode, the first call at boot
+  void enter(RenderContext &ctx, uint8_t mode);
+  // Moves steps modes ahead, wrapping around after the last one
+  void advance(RenderContext &ctx, uint8_t steps);
+  // Stops the mode on screen without switching, for something else to
+  // use the display. enter(current()) brings it back.
+  void suspend();
+  bool suspended() const { return !active; }
+  uint8_t current() const { return currentMode; }
+  uint8_t count() const { return modeCount; }
+  const char *name(uint8_t mode) const { return modes[mode].hooks.name; }
+
+  // One warm-up step of the next mode, false once there is nothing left to do
+  bool warmStep(RenderContext &ctx);
+  // Prints which modes are loaded and how long the last switches took
+  void printStats(Print &out) const;
+
+private:
+  struct Mode {
+    ModeHooks hooks;
+    int8_t    tasks[maxModeTasks];
+    uint8_t   taskCount;
+    bool      loaded;     // Its assets are in memory
+    bool      warming;    // Partly loaded by warmStep()
+    uint32_t  switchTime; // Last switch into it, in milliseconds
+  };
+
+  bool keepWarm(uint8_t mode) const;
+  void releaseMode(uint8_t mode);
+
+  Scheduler &scheduler;
+  Mode       modes[maxModes];
+  size_t     budget;
+  uint8_t    modeCount;
+  uint8_t    currentMode;
+  int8_t     warmTask;
+  bool       active; // A mode is on screen
+};
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "RenderContext.h"
+#include "Animation.h"
+
+const uint32_t patternFrameTime = 33; // The animation runs a fixed step at this rate, in milliseconds
+const size_t patternWarmBytes = 8192; // About what the sprites of the built in content take
+
+// A mode for the heart animation and the personal message :)
+// patternEnter() draws the background and message, then the scheduler
+// calls patternStep() every patternFrameTime to animate the hearts.
+// The content comes from a table in PatternMode.cpp and everything is
+// drawn through a compositor, so only the boxes of hearts that moved,
+// appeared or disappeared are redrawn.
+void patternEnter(RenderContext &ctx);
+// Opens the message and decodes the sprites ahead of patternEnter()
+bool patternWarm(RenderContext &ctx);
+// Replaces the built in content table from the next patternEnter() on,
+// the table must stay valid while the mode runs
+void patternSetContent(const AnimationSpec *specs, uint8_t specCount);
+void patternStep(RenderContext &ctx);
+// Stops, keeping the sprites and message loaded for a quick return
+void patternExit();
+void patternRelease();
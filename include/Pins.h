@@ -0,0 +1,12 @@
+#pragma once
+
+#include <Arduino.h>
+
+// TFT display and SD card share the hardware SPI interface, using
+// 'select' pins for each to identify the active device on the bus.
+
+#define SD_CS      D3 // SD card select pin
+#define TFT_CS     D8 // TFT select pin
+#define TFT_DC     D2 // TFT display/command pin
+#define BUTTON_PIN D1 // Mode change button, pressed pulls it low
+#define TFT_LED    -1 // Backlight pin for dimming (D4 is free), -1 when the LED is tied to 3.3 V
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "RenderContext.h"
+
+// Low power operation for units that run on a battery. In POWER_SAVE
+// the Wi-Fi radio is off, or in modem sleep with a longer listen interval
+// when pictures are pushed over Wi-Fi. With the radio off, the CPU
+// light-sleeps whenever nothing is due for at least lightSleepMin.
+// powerIdle() takes the place of the scheduler's delay() for that. A
+// timer ends the sleep at the next deadline, and the button on the wake
+// pin ends it at once.
+// The CPU timers stop in light sleep, so the sleep is timed on the RTC and
+// powerMillis() adds it onto millis(). Deadlines are kept on that clock.
+// PWM stops in light sleep too, so a dimmed backlight keeps the CPU awake.
+// Serial input sent during a sleep is lost, send a command again if it
+// doesn't answer.
+//
+// The display can sleep through long holds: powerDisplaySleep() turns off
+// the panel and the backlight, and the picture stays in the display's RAM.
+// Static screens that only need 8 colors use the display's idle mode.
+// powerReport() gives the share of time the CPU was busy, idle and asleep,
+// and an estimate of the average current built from the figures below.
+// Sources are the ESP8266 datasheet and typical 2.4" ILI9341 modules, so
+// measure your own board before relying on them.
+
+enum PowerMode : uint8_t {
+  POWER_FULL, // Everything stays on, the CPU idles in delay()
+  POWER_SAVE
+};
+
+const uint32_t lightSleepMin       = 50;   // Shortest wait worth a light sleep, in milliseconds
+const uint32_t powerMaxIdle        = 1000; // Longest wait between scheduler checks in POWER_SAVE, in milliseconds
+const uint32_t powerIdleStep       = 10;   // The wake flag is checked this often while idling awake, in milliseconds
+const uint8_t  wifiListenInterval  = 3;    // Beacons slept through in modem sleep
+const uint32_t displayWakeTime     = 120;  // The ILI9341 needs this long after leaving sleep, in milliseconds
+
+// Estimated supply currents, in microamps
+const uint32_t cpuAwakeUa          = 15000; // CPU running, radio off or in modem sleep
+const uint32_t cpuLightSleepUa     = 900;
+const uint32_t wifiAverageUa       = 5000;  // Radio in modem sleep, on top of the CPU
+const uint32_t displayOnUa         = 6000;  // ILI9341 driving the panel
+const uint32_t displaySleepUa      = 100;
+const uint32_t backlightFullUa     = 40000; // Backlight at 100%
+const uint32_t boardUa             = 5000;  // Regulator and USB bridge of the NodeMCU
+
+// wifiUsed tells whether the radio is needed, webPushBegin() must already
+// have run when it is. wakePin is the button, pressed pulls it low.
+// onWake runs after every light sleep, sleeping takes the pin's interrupt
+// away and onWake has to set it up again.
+void powerBegin(PowerMode mode, bool wifiUsed, uint8_t wakePin, void (*onWake)());
+// Ends the idle wait early when set, like the BMP abort flag
+void powerSetWakeFlag(volatile bool *flag);
+PowerMode powerMode();
+
+// Waits up to ms for the scheduler, asleep when it can
+void powerIdle(uint32_t ms);
+// millis() plus the time lost in light sleep
+uint32_t powerMillis();
+
+// Backlight brightness in percent, only with a TFT_LED pin
+void powerSetBacklight(uint8_t percent);
+// Turns the panel and the backlight off and on again, the picture stays
+void powerDisplaySleep(RenderContext &ctx, bool sleep);
+bool powerDisplayAsleep();
+// 8 color idle mode of the display, for static text screens
+void powerDisplayIdle(RenderContext &ctx, bool idle);
+
+// Prints the busy, idle and sleep shares and the estimated current since the last reset
+void powerReport(Print &out);
+void powerReset();
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <Adafruit_ILI9341.h>     // Hardware-specific library
+#include <SdFat.h>                // SD card & FAT filesystem library
+#include <Adafruit_ImageReader.h> // Image-reading functions
+
+// Everything the draw functions need to put an image on the screen.
+// Only holds references to the global driver objects so passing it
+// around never copies the display, reader or filesystem.
+struct RenderContext {
+  Adafruit_ILI9341     &tft;    // TFT display
+  Adafruit_ImageReader &reader; // Image reader bound to the SD filesystem
+  SdFat                &sd;     // SD card filesystem
+  const uint16_t        width;  // Screen dimensions in pixels
+  const uint16_t        length;
+};
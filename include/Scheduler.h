@@ -0,0 +1,60 @@
+#pragma once
+
+#include <Arduino.h>
+
+typedef void (*TaskCallback)();
+typedef void (*IdleHook)(uint32_t ms); // Waits up to ms between deadlines, may return early
+typedef uint32_t (*ClockSource)();     // Milliseconds the deadlines are kept in
+
+// A periodic job run by the scheduler
+struct Task {
+  const char  *name;
+  TaskCallback callback;
+  uint32_t     period;   // Milliseconds between runs
+  uint32_t     deadline; // millis() value the next run is due at
+  bool         enabled;
+  uint16_t     lateRuns; // Runs that started more than a period after their deadline
+};
+
+// Small cooperative scheduler. Every task runs to completion and tells
+// the scheduler how long to wait until it runs again through its period
+// or runIn(). Between deadlines the CPU is handed back with delay() instead
+// of spinning in yield(), or with an idle hook that can sleep. A hook that
+// stops millis() provides the clock the deadlines are kept on.
+class Scheduler {
+public:
+  static const uint8_t  maxTasks = 12;
+  static const uint32_t maxIdle  = 10; // Longest sleep between checks, in milliseconds
+
+  Scheduler();
+
+  // Registers a task, returns its id or -1 when the table is full
+  int8_t add(const char *name, TaskCallback callback, uint32_t period, bool enabled = true);
+  void enable(int8_t id, bool enabled = true);
+  void disable(int8_t id) { enable(id,false); }
+  bool isEnabled(int8_t id) const;
+  // Moves the next run of a task to ms milliseconds from now
+  void runIn(int8_t id, uint32_t ms);
+  void setPeriod(int8_t id, uint32_t period);
+  // Waits with hook instead of delay() and keeps time with clock, NULL for millis()
+  void setIdleHook(IdleHook hook, ClockSource clock);
+  // Longest wait between checks, maxIdle unless set
+  void setMaxIdle(uint32_t ms) { idleCap = ms; }
+
+  // Runs the ready tasks, earliest deadline first, then sleeps until the
+  // next deadline. Call from loop().
+  void run();
+  // Milliseconds until the earliest enabled deadline, capped at the max idle
+  uint32_t idleTime() const;
+  // The time the deadlines are kept in
+  uint32_t now() const { return clock ? clock() : millis(); }
+  // Prints every task with its late run count
+  void printStats(Print &out) const;
+
+private:
+  Task        tasks[maxTasks];
+  uint8_t     taskCount;
+  uint32_t    idleCap;
+  IdleHook    idleHook;
+  ClockSource clock;
+};
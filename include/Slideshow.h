@@ -0,0 +1,48 @@
+#pragma once
+
+#include "RenderContext.h"
+#include "ImageIndex.h"
+#include "Transition.h"
+
+const uint32_t slideshowRefreshTime = 4000; // Default time between two pictures appearing, in milliseconds
+const uint32_t slideshowDrawMargin = 50; // Extra time a draw is started ahead of its deadline, in milliseconds
+const uint8_t slideshowDrawShare = 50; // Percent of the cadence a picture may take to draw before it is flagged slow
+const size_t prefetchBufferSize = 16384; // RAM used to decode the next picture ahead of time
+const uint16_t prefetchRowsPerStep = 4; // Rows decoded per prefetch step, keeps the button responsive
+const Transition slideshowTransition = TRANSITION_PUSH_UP; // Default way BMP pictures replace each other, JPEGs are always drawn over
+
+// The slideshow mode displays the pictures of an index one by one. It is
+// driven by the scheduler: slideshowStep() runs once per picture and
+// slideshowPrefetchStep() uses the time in between to read the next one.
+// Pictures are due on screen every cadence milliseconds, or after the
+// time their playlist entry gives the one before them. The time each
+// one took to draw is kept in the index, and the next draw starts that
+// much ahead of its deadline, so slow pictures don't push the ones after
+// them back.
+
+// Starts the slideshow where it was left, from the first picture of the
+// index the first time
+void slideshowEnter(RenderContext &ctx, ImageIndex &index);
+// Gets the slideshow ready to show its next picture at once, a few rows
+// per call, true once the rows that fit in RAM are read
+bool slideshowWarm(RenderContext &ctx, ImageIndex &index);
+// Displays the picture read ahead and starts reading the one after it,
+// false when the picture couldn't be read
+bool slideshowStep(RenderContext &ctx);
+// Milliseconds until slideshowStep() should run to have the next picture
+// on screen by its deadline
+uint32_t slideshowTimeToNext();
+// Decodes a few more rows of the next picture, returns true once done
+bool slideshowPrefetchStep();
+// Time between two pictures appearing, slideshowRefreshTime by default
+void slideshowSetCadence(uint32_t ms);
+// How BMP pictures replace each other, slideshowTransition by default
+void slideshowSetTransition(Transition transition);
+// Lists the pictures that were flagged slow with their draw times
+void slideshowReport(Print &out);
+// Stops showing pictures but keeps the next one open and read ahead, so
+// coming back starts with it
+void slideshowExit();
+// Frees the read ahead buffer and closes the picture, the position is kept
+// unless the index changes
+void slideshowRelease();
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <Adafruit_ILI9341.h>
+#include <SdFat.h>
+
+// The SD card and the display share the hardware SPI bus, each with its
+// own clock: SdFat applies the SD clock of its SdSpiConfig on every card
+// transaction, and the display keeps the SPISettings it was begun with.
+// At boot both clocks are tried from fastest to slowest and the first
+// one that passes a readback check is kept.
+
+// Mounts the card at the fastest clock that reads the partition sectors,
+// the start of the FAT and the start of the data area back identically
+// to a slow reference read. Returns the clock in MHz,
+// 0 when the card can't be mounted at all.
+uint8_t calibrateSdClock(SdFat &sd, uint8_t csPin);
+
+// Remounts the card one clock step slower after read errors. False when it
+// is already at the slowest clock or the remount failed. Open files are
+// lost, anything holding one has to reopen it.
+bool sdClockFallback(SdFat &sd);
+
+// Starts the display at the fastest clock where register writes read back
+// correctly. The reads run at a fixed slow clock since the ILI9341 reads
+// far slower than it writes, so only a failed write moves it below the
+// 40 MHz default. Displays that can't be read back stay at 40 MHz.
+// Returns the clock in MHz.
+uint8_t calibrateTftClock(Adafruit_ILI9341 &tft);
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "RenderContext.h"
+#include "ImageFile.h"
+
+// A decoded sprite kept in RAM as RGB565 pixels, row by row from the top
+struct Sprite {
+  uint16_t *pixels;
+  uint16_t  width;
+  uint16_t  height;
+};
+
+// Sprite atlas files (.atl, made by tools/pack_atlas.py) hold several
+// sprites ready to use:
+//   magic "SATL", sprite count (LE16), 2 reserved bytes
+//   count entries of name (16 bytes, NUL padded), width (LE16), height (LE16)
+//   the pixels of every sprite in the same order, top down LE16 RGB565
+// A sprite is named after its file without the directory or extension,
+// "/pattern/heart.bmp" -> "heart".
+const uint32_t atlasMagic      = 0x4C544153;
+const uint8_t  atlasHeaderSize = 8;
+const uint8_t  atlasNameLength = 16;
+const uint8_t  atlasEntrySize  = atlasNameLength+4;
+
+// Small store of sprites decoded once from the SD card so they can be
+// blitted straight to the display without touching the card again.
+// Sprites are addressed by the id returned from load(), or looked up
+// by name with find(). The pixels live in the arena's sprite pool, so
+// only one cache holds sprites at a time.
+class SpriteCache {
+public:
+  static const uint8_t maxSprites = 8;
+
+  SpriteCache();
+  ~SpriteCache();
+
+  // Reads every sprite of an atlas file, the pixels with a single read
+  // into one block. Returns how many sprites were added.
+  uint8_t loadAtlas(RenderContext &ctx, const char *filename);
+  // Same with an atlas that is already open, from the card or the flash
+  uint8_t loadAtlas(ImageFile file);
+  // Decodes a BMP file into RAM, returns its sprite id or -1 on failure
+  int8_t load(RenderContext &ctx, const char *filename);
+  // Id of the cached sprite with the name of a file, -1 when there isn't one
+  int8_t find(const char *filename) const;
+  // Draws a cached sprite with its top left corner at x,y
+  void draw(RenderContext &ctx, int8_t id, int16_t x, int16_t y) const;
+  const Sprite *get(int8_t id) const;
+  // Gives the pixels of every cached sprite back to the arena
+  void clear();
+  uint8_t size() const { return count; }
+
+private:
+  Sprite  sprites[maxSprites];
+  char    names[maxSprites][atlasNameLength];
+  uint8_t count;
+};
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "RenderContext.h"
+#include "BmpStream.h"
+
+// Ways the slideshow can change from one picture to the next
+enum Transition : uint8_t {
+  TRANSITION_NONE,      // Draw the new picture over the old one
+  TRANSITION_WIPE,      // Full width bands top to bottom, clears what the old picture left around the new one
+  TRANSITION_PUSH_UP,   // The new picture pushes the old one up and out of the screen
+  TRANSITION_PUSH_DOWN  // Same, coming in from the top
+};
+
+const uint16_t transitionBandRows = 8; // Rows written per step of a transition
+const uint32_t transitionStepTime = 8; // Shortest time between two scroll steps, sets the speed of a push
+
+// Pushes use the display's vertical scrolling: each band of the new picture
+// is written into the frame memory rows that are about to scroll into view,
+// then only the scroll start register changes. Every row is sent once, the
+// same traffic as a plain draw, and the motion costs a 2 byte write per step.
+// Once the push is done the scroll is back at 0 with the new picture in place.
+// Scrolling runs along the panel's 320 rows, in landscape rotations (1 and
+// 3) pushes fall back to a wipe. On the upside down rotation 2 the scroll
+// is mirrored so pushes keep their direction on screen.
+
+// Draws the picture prepared by next with the given transition
+ImageReturnCode drawTransition(RenderContext &ctx, BmpPrefetch &next, Transition transition, uint16_t background);
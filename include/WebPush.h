@@ -0,0 +1,43 @@
+#pragma once
+
+#include "RenderContext.h"
+
+// Pictures pushed over Wi-Fi. A browser or
+//   curl -F "image=@photo.565" "http://<device>/push?save=1"
+// uploads a .565 file or an uncompressed 16/24 bit BMP, and each chunk
+// goes to the display as it arrives off the socket, without waiting for
+// the rest of the file. With save=1 the file is written to the
+// slideshow directory at the same time, under a temporary name that is
+// renamed only once the whole picture was shown. Only plain .bmp and .565
+// names are saved, and an existing picture is only replaced with
+// overwrite=1, which also drops the old picture's .565 copy. A .565 is
+// never saved next to a .bmp of the same name, that name is its cached
+// copy. Refused or broken uploads get a 4xx/5xx reply with the reason.
+// .565 pictures that fit the screen go from the web server's buffer
+// straight to SPI. BMP rows, and rows of pictures cropped to the screen,
+// are converted one at a time.
+// The upload is read only as fast as the display takes it. TCP flow
+// control slows the sender down while pixels are written, and every
+// chunk yields to the Wi-Fi stack (and the watchdog).
+
+// How one push went, for the report and the done hook
+struct PushReport {
+  uint32_t bytes;     // Size of the upload
+  uint32_t uploadMs;  // First byte to last byte
+  uint32_t displayMs; // First byte to the last row on screen, 0 when nothing was shown
+  bool     shown;
+  bool     saved;     // Written to the card in full
+};
+
+// Called before the first pixel goes out and after the upload finished,
+// the mode on screen has to stop drawing in between
+typedef void (*PushStartHook)();
+typedef void (*PushDoneHook)(const PushReport &report);
+
+// Joins the network and starts the web server, false without credentials
+bool webPushBegin(RenderContext &ctx, const char *ssid, const char *password, const char *saveDir,
+                  PushStartHook onStart, PushDoneHook onDone);
+// Serves the waiting clients, from a scheduler task
+void webPushPoll();
+// The last push, bytes is 0 before the first one
+const PushReport &webPushLast();
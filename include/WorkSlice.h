@@ -0,0 +1,38 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Long jobs, scanning the card, converting pictures, copying assets to
+// flash and streaming a picture to the display, are cut into slices so
+// they never keep the CPU long enough for the soft watchdog to reset the
+// board or for Wi-Fi to drop. Their loops call workCheckpoint() after
+// every unit of work, which only yields once the current slice has run
+// for workSliceBudget, so short jobs don't pay for it.
+//
+// Every yield through here closes a slice and the time since the last
+// one is kept per site, printed when 'w' is sent over the serial monitor.
+// Yields inside the libraries aren't seen, so the gaps are an upper bound.
+// Sites are the names passed in, string literals that are never copied.
+
+const uint32_t workSliceBudget = 10000;  // Slice length before a checkpoint yields, in microseconds
+const uint32_t workGapWarning  = 100000; // Gaps this long are counted as late, in microseconds
+const uint8_t  workSiteMax     = 16;     // Sites tracked, later ones go under the last
+
+// Yields when the current slice is over budget
+void workCheckpoint(const char *site);
+// Always yields
+void workYield(const char *site);
+// delay() that also closes the slice
+void workDelay(const char *site, uint32_t ms);
+// The same around some other wait: workPause() closes the slice before it,
+// workResume() starts the next one after it
+void workPause(const char *site);
+void workResume();
+
+// Longest gap between two yields since the last reset, in microseconds
+uint32_t workLongestGap();
+const char *workLongestSite();
+// Prints the longest gap, the number of yields and the late gaps of every site
+void workReport(Print &out);
+// Starts the stats over, the next slice starts now
+void workReset();
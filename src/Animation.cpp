@@ -0,0 +1,264 @@
+#include "Animation.h"
+#include "Instrument.h"
+
+static const uint8_t  noCell  = 0xFF;
+static const uint16_t easeOne = 1024; // 1.0 in the fixed point easing math
+
+// Eased progress for t going from 0 to easeOne
+static uint32_t ease(Easing easing, uint32_t t){
+  switch(easing){
+  case EASE_OUT:
+    return easeOne-((easeOne-t)*(easeOne-t))/easeOne;
+  case EASE_IN_OUT:
+    return (((t*t)>>10)*(3*easeOne-2*t))>>10;
+  case EASE_LINEAR:
+  default:
+    return t;
+  }
+}
+
+Animation::Animation(Compositor &compositor, SpriteCache &sprites) : compositor(compositor), sprites(sprites),
+  specs(NULL), specCount(0), actorCount(0), gridCols(0), gridRows(0), cellWidth(0), cellHeight(0), cellGap(0),
+  freeCells(0), lastFrame(0), pending(0), statsStart(0), frames(0), droppedSteps(0), worstFrameUs(0) {}
+
+void Animation::begin(RenderContext &ctx, const AnimationSpec *table, uint8_t tableSize,
+                      const Rect &popRect, uint16_t gap){
+
+  specs     = table;
+  specCount = min<uint8_t>(tableSize,maxSpecs);
+  screen.x  = 0;
+  screen.y  = 0;
+  screen.w  = ctx.width;
+  screen.h  = ctx.length;
+  popArea   = popRect;
+  cellGap   = gap;
+  actorCount = 0;
+
+  int8_t spriteIds[maxSpecs];
+  uint16_t popWidth = 0, popHeight = 0; // Largest popping sprite, sizes the grid
+  for(uint8_t i=0;i<specCount;i++){
+    const AnimationSpec &spec = specs[i];
+
+    // Sprites come from the atlas when it has them, rows drawing the
+    // same file share the cached sprite
+    spriteIds[i] = sprites.find(spec.spritePath);
+    if(spriteIds[i]<0){
+      spriteIds[i] = sprites.load(ctx,spec.spritePath);
+    }
+    const Sprite *sprite = sprites.get(spriteIds[i]);
+    popTimers[i]  = 0;
+    firstActor[i] = actorCount;
+    if(!sprite){
+      continue;
+    }
+    if(spec.motion==MOTION_POP){
+      popWidth  = max(popWidth,sprite->width);
+      popHeight = max(popHeight,sprite->height);
+    }
+
+    for(uint8_t n=0;n<spec.count&&actorCount<maxActors;n++){
+      Actor &actor = actors[actorCount++];
+      actor.spec   = &spec;
+      actor.width  = sprite->width;
+      actor.height = sprite->height;
+      actor.cell   = noCell;
+      actor.x = (int32_t)(screen.w>actor.width ? random(screen.w-actor.width) : 0)<<8;
+      actor.y = (int32_t)(screen.h>actor.height ? random(screen.h-actor.height) : 0)<<8;
+      actor.vx = actor.vy = 0;
+      actor.elapsed = 0;
+
+      if(spec.motion==MOTION_DRIFT){
+        // Pixels per second to 1/256 pixels per step, in a random direction
+        int32_t perStep = (int32_t)spec.speed*256*frameTime/1000;
+        actor.vx = perStep*random(50,101)/100*(random(2) ? 1 : -1);
+        actor.vy = perStep*random(50,101)/100*(random(2) ? 1 : -1);
+      }else if(spec.motion==MOTION_GLIDE){
+        newGlide(actor);
+      }
+      actor.layer = compositor.addLayer(spriteIds[i],actor.x>>8,actor.y>>8,spec.motion!=MOTION_POP);
+    }
+  }
+
+  // Grid for the popping sprites
+  gridCols = gridRows = freeCells = 0;
+  if(popWidth>0){
+    gridCols = min<uint16_t>(popArea.w/(popWidth+cellGap),maxCells);
+    gridRows = gridCols ? min<uint16_t>(popArea.h/(popHeight+cellGap),maxCells/gridCols) : 0;
+    cellWidth  = gridCols ? popArea.w/gridCols : 0;
+    cellHeight = gridRows ? popArea.h/gridRows : 0;
+    freeCells  = gridCols*gridRows;
+  }
+  for(uint8_t i=0;i<maxCells;i++){
+    cellUsed[i] = false;
+  }
+
+  lastFrame    = millis();
+  pending      = 0;
+  statsStart   = lastFrame;
+  frames       = 0;
+  droppedSteps = 0;
+  worstFrameUs = 0;
+}
+
+void Animation::frame(RenderContext &ctx){
+
+  uint32_t start = micros();
+  uint32_t now = millis();
+  pending += now-lastFrame;
+  lastFrame = now;
+
+  // Simulate the time that passed in fixed steps, a frame that fell too far
+  // behind drops the steps it can't fit instead of making the next one late too
+  uint8_t steps = 0;
+  while(pending>=frameTime){
+    if(steps==maxCatchUp){
+      droppedSteps += pending/frameTime;
+      pending %= frameTime;
+      break;
+    }
+    step();
+    pending -= frameTime;
+    steps++;
+  }
+
+  if(steps>0){
+    compositor.flush(ctx);
+    frames++;
+  }
+  uint32_t frameUs = micros()-start;
+  if(frameUs>worstFrameUs){
+    worstFrameUs = frameUs;
+  }
+  if(now-statsStart>=statsInterval){
+    reportStats();
+  }
+}
+
+void Animation::step(){
+  for(uint8_t i=0;i<specCount;i++){
+    if(specs[i].motion!=MOTION_POP){
+      continue;
+    }
+    popTimers[i] += frameTime;
+    if(popTimers[i]>=specs[i].duration){
+      popTimers[i] = 0;
+      stepPop(i);
+    }
+  }
+  for(uint8_t i=0;i<actorCount;i++){
+    if(actors[i].spec->motion!=MOTION_POP){
+      stepActor(actors[i]);
+    }
+  }
+}
+
+// Pick a random sprite of the row and see if it is on screen, if so clear it,
+// else show it on a free cell at a random spot inside it
+void Animation::stepPop(uint8_t specIndex){
+
+  uint8_t first = firstActor[specIndex];
+  uint8_t last  = specIndex+1<specCount ? firstActor[specIndex+1] : actorCount;
+  if(first>=last){
+    return;
+  }
+  Actor &actor = actors[first+random(last-first)];
+
+  if(compositor.isVisible(actor.layer)){
+    compositor.showLayer(actor.layer,false);
+    releaseCell(actor.cell);
+    actor.cell = noCell;
+    return;
+  }
+
+  uint8_t cell = takeFreeCell();
+  if(cell==noCell){
+    return; // Every cell is taken
+  }
+  // Leave the gap to the next cell free
+  int16_t x = popArea.x+(cell%gridCols)*cellWidth+random(cellWidth-actor.width-cellGap+1);
+  int16_t y = popArea.y+(cell/gridCols)*cellHeight+random(cellHeight-actor.height-cellGap+1);
+  actor.cell = cell;
+  actor.x = (int32_t)x<<8;
+  actor.y = (int32_t)y<<8;
+  compositor.moveLayer(actor.layer,x,y);
+  compositor.showLayer(actor.layer,true);
+}
+
+void Animation::stepActor(Actor &actor){
+
+  int16_t oldX = actor.x>>8, oldY = actor.y>>8;
+
+  if(actor.spec->motion==MOTION_DRIFT){
+    // Bounce off the edges of the screen
+    int32_t maxX = (int32_t)(screen.x+screen.w-actor.width)<<8;
+    int32_t maxY = (int32_t)(screen.y+screen.h-actor.height)<<8;
+    actor.x += actor.vx;
+    actor.y += actor.vy;
+    if(actor.x<((int32_t)screen.x<<8)){ actor.x = (int32_t)screen.x<<8; actor.vx = -actor.vx; }
+    if(actor.x>maxX){ actor.x = maxX; actor.vx = -actor.vx; }
+    if(actor.y<((int32_t)screen.y<<8)){ actor.y = (int32_t)screen.y<<8; actor.vy = -actor.vy; }
+    if(actor.y>maxY){ actor.y = maxY; actor.vy = -actor.vy; }
+  }else{
+    actor.elapsed += frameTime;
+    if(actor.elapsed>=actor.spec->duration){
+      actor.x = (int32_t)actor.toX<<8;
+      actor.y = (int32_t)actor.toY<<8;
+      newGlide(actor);
+    }else{
+      uint32_t t = ease(actor.spec->easing,actor.elapsed*easeOne/actor.spec->duration);
+      actor.x = ((int32_t)actor.fromX<<8)+(((int32_t)(actor.toX-actor.fromX)*(int32_t)t)<<8)/easeOne;
+      actor.y = ((int32_t)actor.fromY<<8)+(((int32_t)(actor.toY-actor.fromY)*(int32_t)t)<<8)/easeOne;
+    }
+  }
+
+  // Only whole pixel moves need a redraw
+  if((actor.x>>8)!=oldX||(actor.y>>8)!=oldY){
+    compositor.moveLayer(actor.layer,actor.x>>8,actor.y>>8);
+  }
+}
+
+// Starts a move from where the sprite is to a random spot on the screen
+void Animation::newGlide(Actor &actor){
+  actor.fromX   = actor.x>>8;
+  actor.fromY   = actor.y>>8;
+  actor.toX     = screen.x+(screen.w>actor.width ? random(screen.w-actor.width) : 0);
+  actor.toY     = screen.y+(screen.h>actor.height ? random(screen.h-actor.height) : 0);
+  actor.elapsed = 0;
+}
+
+// Takes a random free cell of the grid, in time bounded by the grid size
+uint8_t Animation::takeFreeCell(){
+  INSTRUMENT_SCOPE(PROBE_CELL_SEARCH);
+  if(freeCells==0){
+    return noCell;
+  }
+  uint8_t pick = random(freeCells); // Which of the free cells, in grid order
+  for(uint8_t cell=0;cell<gridCols*gridRows;cell++){
+    if(!cellUsed[cell]&&pick--==0){
+      cellUsed[cell] = true;
+      freeCells--;
+      return cell;
+    }
+  }
+  return noCell;
+}
+
+void Animation::releaseCell(uint8_t cell){
+  if(cell!=noCell&&cellUsed[cell]){
+    cellUsed[cell] = false;
+    freeCells++;
+  }
+}
+
+void Animation::reportStats(){
+  uint32_t now = millis();
+  uint32_t elapsed = now-statsStart;
+  Serial.printf("Animation: %lu fps, worst frame %lu us, %u dropped steps, %lu pixels pushed\n",
+                (unsigned long)(frames*1000UL/elapsed), (unsigned long)worstFrameUs, droppedSteps,
+                (unsigned long)compositor.pushedPixels);
+  statsStart   = now;
+  frames       = 0;
+  droppedSteps = 0;
+  worstFrameUs = 0;
+  compositor.pushedPixels = 0;
+}
@@ -0,0 +1,594 @@
+#include "BmpStream.h"
+#include "Instrument.h"
+#include "ImageArena.h"
+#include "WorkSlice.h"
+
+// Longest row that can be visible on the display in any rotation
+static const uint16_t maxRowPixels = ILI9341_TFTHEIGHT;
+
+// Rows are read from the card in large blocks so the bus switches between
+// the SD card and the display once per block instead of once per row
+static const uint16_t blockBytes  = 4096;
+static const uint16_t blockPixels = 2048;
+
+static uint8_t  fileBlock[blockBytes];   // Consecutive rows as read from the file
+static uint16_t pixelBlock[blockPixels]; // The visible part of those rows converted to RGB565
+static uint16_t palette[256];             // RGB565 palette of 1/4/8 bit images
+static volatile bool *abortFlag = NULL;   // Stops a draw between blocks when set
+static uint32_t pixelBytesRead = 0;       // Running total of readBmpRows(), see bmpBytesRead()
+
+// Downscaled images are averaged one screen row at a time, each source row is
+// converted in chunks and added into per column sums
+static uint16_t boxSums[3][maxRowPixels];
+static uint16_t scaleRow[maxRowPixels];
+static bool     downscale = true;
+
+// Rows are read whole while it costs less than this much to read past the
+// columns that are off screen, otherwise only the visible span of each row is read
+static const uint16_t minSkipBytes = 1024;
+
+static uint16_t readLE16(ImageFile &file){
+  uint8_t b[2];
+  file.read(b,2);
+  return b[0] | (b[1]<<8);
+}
+
+static uint32_t readLE32(ImageFile &file){
+  uint8_t b[4];
+  file.read(b,4);
+  return b[0] | (b[1]<<8) | ((uint32_t)b[2]<<16) | ((uint32_t)b[3]<<24);
+}
+
+void setBmpAbortFlag(volatile bool *flag){
+  abortFlag = flag;
+}
+
+bool bmpAbortRequested(){
+  return abortFlag&&*abortFlag;
+}
+
+void setBmpDownscale(bool enabled){
+  downscale = enabled;
+}
+
+static inline uint16_t color565(uint8_t r, uint8_t g, uint8_t b){
+  return ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3);
+}
+
+// Header of a .565 file, the magic is followed by the width and height
+static ImageReturnCode readRaw565Header(ImageFile &file, BmpHeader &header){
+
+  header.width       = readLE16(file);
+  header.height      = readLE16(file);
+  header.pixelOffset = raw565HeaderSize;
+  header.rowSize     = header.width*2;
+  header.depth       = 16;
+  header.bottomUp    = false;
+  header.rgb555      = false;
+  header.raw565      = true;
+  if(header.width==0||header.height==0){
+    return IMAGE_ERR_FORMAT;
+  }
+  return IMAGE_SUCCESS;
+}
+
+ImageReturnCode readBmpHeader(ImageFile file, BmpHeader &header){
+
+  INSTRUMENT_SCOPE(PROBE_HEADER);
+  if(!file.isFile()||!file.seekSet(0)){
+    return IMAGE_ERR_FILE_NOT_FOUND;
+  }
+  uint16_t signature = readLE16(file);
+  if(signature==(raw565Magic&0xFFFF)&&readLE16(file)==(raw565Magic>>16)){
+    return readRaw565Header(file,header);
+  }
+  if(signature!=0x4D42){ // "BM" signature
+    return IMAGE_ERR_FORMAT;
+  }
+  header.raw565 = false;
+  readLE32(file); // File size
+  readLE32(file); // Reserved
+  header.pixelOffset = readLE32(file);
+  uint32_t dibSize   = readLE32(file);
+  header.width       = (int32_t)readLE32(file);
+  header.height      = (int32_t)readLE32(file);
+  uint16_t planes    = readLE16(file);
+  header.depth       = readLE16(file);
+  uint32_t compression = readLE32(file);
+
+  if(planes!=1||header.width<=0||header.height==0){
+    return IMAGE_ERR_FORMAT;
+  }
+
+  // A negative height means the rows are stored top down
+  header.bottomUp = header.height>0;
+  if(header.height<0){
+    header.height = -header.height;
+  }
+  header.rowSize = ((uint32_t)header.width*header.depth+31)/32*4; // Rows pad to whole 32 bit words
+  header.rgb555 = false;
+
+  switch(header.depth){
+  case 24:
+    if(compression!=0){
+      return IMAGE_ERR_FORMAT;
+    }
+    break;
+  case 16:
+    if(compression==0){
+      header.rgb555 = true;
+    }else if(compression==3){
+      // Bit field masks follow the info header
+      file.seekSet(54);
+      header.rgb555 = readLE32(file)==0x7C00;
+    }else{
+      return IMAGE_ERR_FORMAT;
+    }
+    break;
+  case 1:
+  case 4:
+  case 8:{
+    if(compression!=0){
+      return IMAGE_ERR_FORMAT;
+    }
+    // Palette entries are stored as BGRA right after the DIB header
+    file.seekSet(46);
+    uint32_t colors = readLE32(file);
+    if(colors==0||colors>(1UL<<header.depth)){
+      colors = 1UL<<header.depth;
+    }
+    file.seekSet(14+dibSize);
+    for(uint16_t i=0;i<colors;i++){
+      uint8_t bgra[4];
+      file.read(bgra,4);
+      palette[i] = color565(bgra[2],bgra[1],bgra[0]);
+    }
+    break;
+  }
+  default:
+    return IMAGE_ERR_FORMAT;
+  }
+
+  return IMAGE_SUCCESS;
+}
+
+// Converts count pixels starting at column firstCol of the raw file row
+void convertBmpRow(const BmpHeader &header, const uint8_t *src, uint16_t firstCol, uint16_t count, uint16_t *out){
+  switch(header.depth){
+  case 24:
+    for(uint16_t i=0;i<count;i++,src+=3){
+      out[i] = color565(src[2],src[1],src[0]);
+    }
+    break;
+  case 16:
+    for(uint16_t i=0;i<count;i++,src+=2){
+      uint16_t c = src[0] | (src[1]<<8);
+      if(header.rgb555){
+        c = ((c & 0x7FE0) << 1) | ((c & 0x0200) >> 4) | (c & 0x001F);
+      }
+      out[i] = c;
+    }
+    break;
+  default:{
+    // Palette images, several pixels per byte with the leftmost pixel in the top bits
+    const uint8_t mask = (1<<header.depth)-1;
+    for(uint16_t i=0;i<count;i++){
+      uint32_t bit = (uint32_t)(firstCol+i)*header.depth;
+      uint8_t shift = 8-header.depth-(bit&7);
+      out[i] = palette[(src[bit>>3]>>shift)&mask];
+    }
+    break;
+  }
+  }
+}
+
+bool clipBmp(const BmpHeader &header, int16_t x, int16_t y,
+             int16_t clipX, int16_t clipY, int16_t clipW, int16_t clipH, BmpLayout &layout, uint8_t scale){
+
+  // .565 pixels go out untouched, they are never scaled
+  if(header.raw565||scale==0){
+    scale = 1;
+  }
+
+  // Clip the image, at its size on the screen, to the region
+  int32_t firstCol = x<clipX ? clipX-x : 0;
+  int32_t firstRow = y<clipY ? clipY-y : 0;
+  int32_t drawWidth  = min<int32_t>(header.width/scale, clipX+clipW-x)-firstCol;
+  int32_t drawHeight = min<int32_t>(header.height/scale, clipY+clipH-y)-firstRow;
+  if(drawWidth<=0||drawHeight<=0){
+    return false; // Nothing inside the region
+  }
+  if(drawWidth>maxRowPixels){
+    drawWidth = maxRowPixels;
+  }
+
+  layout.x        = x+firstCol;
+  layout.y        = y+firstRow;
+  layout.width    = drawWidth;
+  layout.height   = drawHeight;
+  layout.firstCol = firstCol*scale;
+  layout.firstRow = firstRow*scale;
+  layout.scale    = scale;
+
+  // Byte span of the visible columns inside one file row, palette spans
+  // start at the byte holding the first visible pixel
+  uint32_t sourceCols = (uint32_t)drawWidth*scale;
+  if(header.depth>=16){
+    layout.spanStart = layout.firstCol*(header.depth/8);
+    layout.spanBytes = sourceCols*(header.depth/8);
+  }else{
+    layout.spanStart = (uint32_t)layout.firstCol*header.depth/8;
+    layout.spanBytes = ((layout.firstCol+sourceCols)*header.depth+7)/8-layout.spanStart;
+  }
+  return true;
+}
+
+bool layoutBmp(RenderContext &ctx, const BmpHeader &header, int16_t x, int16_t y, BmpLayout &layout){
+  return clipBmp(header,x,y,0,0,ctx.width,ctx.length,layout);
+}
+
+uint8_t bmpFitScale(RenderContext &ctx, const BmpHeader &header){
+
+  if(!downscale||header.raw565){
+    return 1;
+  }
+  uint8_t scale = 1;
+  while(scale<maxBmpScale&&(header.width/scale>ctx.width||header.height/scale>ctx.length)){
+    scale++;
+  }
+  return scale;
+}
+
+bool layoutBmpCentered(RenderContext &ctx, const BmpHeader &header, BmpLayout &layout){
+
+  // Whatever still doesn't fit at the largest scale is cropped around the middle
+  uint8_t scale = bmpFitScale(ctx,header);
+  return clipBmp(header,(ctx.width-header.width/scale)/2,(ctx.length-header.height/scale)/2,
+                 0,0,ctx.width,ctx.length,layout,scale);
+}
+
+// Column of the first visible pixel inside the span, palette rows pack
+// several pixels per byte
+static inline uint16_t spanFirstCol(const BmpHeader &header, const BmpLayout &layout){
+  return header.depth>=16 ? 0 : layout.firstCol-layout.spanStart*8/header.depth;
+}
+
+// Downscaled rows, every screen pixel is the average of a scale by scale box
+// of image pixels. Only the visible span of each image row is read.
+static uint16_t readScaledRows(ImageFile file, const BmpHeader &header, const BmpLayout &layout, uint16_t row, uint16_t rows, uint16_t *out){
+
+  const uint8_t  scale      = layout.scale;
+  const uint16_t area       = scale*scale;
+  const uint16_t chunk      = maxRowPixels/scale*scale;
+  const uint32_t sourceCols = (uint32_t)layout.width*scale;
+  const uint16_t firstCol   = spanFirstCol(header,layout);
+
+  for(uint16_t i=0;i<rows;i++){
+    memset(boxSums,0,sizeof(boxSums));
+    for(uint8_t s=0;s<scale;s++){
+      uint32_t imageRow = layout.firstRow+(uint32_t)(row+i)*scale+s;
+      uint32_t fileRow  = header.bottomUp ? header.height-1-imageRow : imageRow;
+      file.seekSet(header.pixelOffset+fileRow*header.rowSize+layout.spanStart);
+      int got = file.read(fileBlock,layout.spanBytes);
+      if(got<0||(uint32_t)got<layout.spanBytes){
+        return 0;
+      }
+      pixelBytesRead += got;
+      for(uint32_t done=0;done<sourceCols;done+=chunk){
+        uint16_t count = min<uint32_t>(chunk,sourceCols-done);
+        if(header.depth>=16){
+          convertBmpRow(header,&fileBlock[done*(header.depth/8)],0,count,scaleRow);
+        }else{
+          convertBmpRow(header,fileBlock,firstCol+done,count,scaleRow);
+        }
+        uint16_t col = done/scale;
+        for(uint16_t p=0;p<count;p+=scale,col++){
+          for(uint8_t k=0;k<scale;k++){
+            uint16_t c = scaleRow[p+k];
+            boxSums[0][col] += c>>11;
+            boxSums[1][col] += (c>>5)&0x3F;
+            boxSums[2][col] += c&0x1F;
+          }
+        }
+      }
+    }
+    uint16_t *dst = &out[(uint32_t)i*layout.width];
+    for(uint16_t col=0;col<layout.width;col++){
+      dst[col] = ((boxSums[0][col]/area)<<11)|((boxSums[1][col]/area)<<5)|(boxSums[2][col]/area);
+    }
+    workCheckpoint("bmp scale"); // Up to 4 source rows per output row
+  }
+  return rows;
+}
+
+uint16_t readBmpRows(ImageFile file, const BmpHeader &header, const BmpLayout &layout, uint16_t row, uint16_t maxRows, uint16_t *out){
+
+  INSTRUMENT_SCOPE(PROBE_PIXEL_READ);
+  uint16_t rows = min<uint16_t>(maxRows, layout.height-row);
+  if(layout.scale>1){
+    return readScaledRows(file,header,layout,row,rows,out);
+  }
+  if(header.raw565&&layout.spanBytes==header.rowSize){
+    // Whole rows of a .565 file go straight into the pixel buffer
+    uint32_t bytes = (uint32_t)rows*header.rowSize;
+    file.seekSet(header.pixelOffset+(uint32_t)(layout.firstRow+row)*header.rowSize);
+    if(file.read(out,bytes)!=(int)bytes){
+      return 0;
+    }
+    pixelBytesRead += bytes;
+    return rows;
+  }
+
+  // Rows go in one block read when little of them is off screen. Otherwise
+  // each row's visible span is read on its own and the rest is skipped, so
+  // cropped images cost about what their visible part does.
+  bool wholeRows = header.rowSize<=blockBytes&&header.rowSize-layout.spanBytes<minSkipBytes;
+  uint32_t stride = wholeRows ? header.rowSize : layout.spanBytes;
+  uint32_t offset = wholeRows ? layout.spanStart : 0; // Where the span starts in a block row
+  rows = min<uint32_t>(rows, blockBytes/stride);
+  if(rows==0){
+    return 0;
+  }
+
+  // The display is filled top down, so bottom up files keep the block's rows in reverse.
+  // Either way the rows of one block are next to each other in the file.
+  uint32_t imageRow = layout.firstRow+row;
+  uint32_t lowestFileRow = header.bottomUp ? header.height-imageRow-rows : imageRow;
+  if(wholeRows){
+    // The last row of a file may be missing its padding
+    uint32_t needed = (uint32_t)(rows-1)*stride+offset+layout.spanBytes;
+    file.seekSet(header.pixelOffset+lowestFileRow*header.rowSize);
+    int got = file.read(fileBlock,(uint32_t)rows*stride);
+    if(got<0||(uint32_t)got<needed){
+      return 0;
+    }
+    pixelBytesRead += got;
+  }else{
+    for(uint16_t i=0;i<rows;i++){
+      file.seekSet(header.pixelOffset+(lowestFileRow+i)*header.rowSize+layout.spanStart);
+      if(file.read(&fileBlock[i*stride],layout.spanBytes)!=(int)layout.spanBytes){
+        return 0;
+      }
+      pixelBytesRead += layout.spanBytes;
+    }
+  }
+
+  if(header.raw565){
+    // Already in display order, rows only need to be moved next to each other
+    for(uint16_t i=0;i<rows;i++){
+      memcpy(&out[(uint32_t)i*layout.width],&fileBlock[i*stride+offset],layout.width*2);
+    }
+    return rows;
+  }
+
+  uint16_t firstCol = spanFirstCol(header,layout);
+  for(uint16_t i=0;i<rows;i++){
+    uint16_t blockRow = header.bottomUp ? rows-1-i : i;
+    convertBmpRow(header,&fileBlock[blockRow*stride+offset],firstCol,layout.width,&out[(uint32_t)i*layout.width]);
+  }
+  return rows;
+}
+
+// Streams rows [firstRow, height) of the layout, the address window must already be set
+static ImageReturnCode streamRows(RenderContext &ctx, ImageFile file, const BmpHeader &header, const BmpLayout &layout, uint16_t firstRow){
+
+  const uint16_t maxRows = blockPixels/layout.width;
+  uint16_t row = firstRow;
+  while(row<layout.height){
+    if(bmpAbortRequested()){
+      return IMAGE_SUCCESS; // Something more urgent came up, the caller knows from its flag
+    }
+    uint16_t rows = readBmpRows(file,header,layout,row,maxRows,pixelBlock);
+    if(rows==0){
+      return IMAGE_ERR_FORMAT;
+    }
+    // The SD card and display share the bus, only select the display while
+    // pushing pixels. The whole block goes out in one transaction and the
+    // address window carries on between blocks.
+    {
+      INSTRUMENT_SCOPE(PROBE_SPI_PUSH);
+      ctx.tft.startWrite();
+      ctx.tft.writePixels(pixelBlock,(uint32_t)rows*layout.width,true,header.raw565);
+      ctx.tft.endWrite();
+    }
+    row += rows;
+    workCheckpoint("bmp stream");
+  }
+  return IMAGE_SUCCESS;
+}
+
+// Streams the pixels of a file whose header has already been parsed
+static ImageReturnCode streamBmp(RenderContext &ctx, ImageFile file, const BmpHeader &header, const BmpLayout &layout){
+
+  ctx.tft.startWrite();
+  ctx.tft.setAddrWindow(layout.x,layout.y,layout.width,layout.height);
+  ctx.tft.endWrite();
+  return streamRows(ctx,file,header,layout,0);
+}
+
+ImageReturnCode drawBmp(RenderContext &ctx, ImageFile file, int16_t x, int16_t y){
+
+  BmpHeader header;
+  ImageReturnCode stat = readBmpHeader(file,header);
+  if(stat!=IMAGE_SUCCESS){
+    return stat;
+  }
+  BmpLayout layout;
+  if(!layoutBmp(ctx,header,x,y,layout)){
+    return IMAGE_SUCCESS;
+  }
+  return streamBmp(ctx,file,header,layout);
+}
+
+ImageReturnCode drawBmpCentered(RenderContext &ctx, ImageFile file){
+
+  BmpHeader header;
+  ImageReturnCode stat = readBmpHeader(file,header);
+  if(stat!=IMAGE_SUCCESS){
+    return stat;
+  }
+  BmpLayout layout;
+  if(!layoutBmpCentered(ctx,header,layout)){
+    return IMAGE_SUCCESS;
+  }
+  return streamBmp(ctx,file,header,layout);
+}
+
+BmpPrefetch::BmpPrefetch() : swapTime(0), drawTime(0), prefetchedRows(0), bytesRead(0), buffer(NULL), capacity(0), file(), status(IMAGE_ERR_FILE_NOT_FOUND), visible(false), rowCapacity(0), rowsReady(0) {}
+
+bool BmpPrefetch::begin(size_t bufferBytes){
+
+  if(buffer){
+    return true;
+  }
+  // Settle for what the sprites left of the image area
+  bufferBytes = min(bufferBytes,arenaAvailable(POOL_PREFETCH))&~(size_t)3;
+  buffer = bufferBytes>=minBufferBytes ? arenaTake<uint16_t>(POOL_PREFETCH,bufferBytes/2) : NULL;
+  if(!buffer){
+    Serial.println(F("No room in the arena to prefetch, images will load on display"));
+    return false;
+  }
+  capacity = bufferBytes;
+  return true;
+}
+
+void BmpPrefetch::end(){
+  if(buffer){
+    arenaRelease(POOL_PREFETCH);
+  }
+  buffer = NULL;
+  capacity = 0;
+  rowCapacity = 0;
+  rowsReady = 0;
+  file = ImageFile();
+}
+
+void BmpPrefetch::start(RenderContext &ctx, ImageFile next){
+
+  file = next;
+  rowsReady = 0;
+  rowCapacity = 0;
+  bytesRead = 0;
+  status = readBmpHeader(next,header);
+  visible = status==IMAGE_SUCCESS &&
+            layoutBmpCentered(ctx,header,layout);
+  if(visible&&buffer){
+    rowCapacity = min<uint32_t>(capacity/(layout.width*sizeof(uint16_t)),layout.height);
+  }
+}
+
+bool BmpPrefetch::step(uint16_t rows){
+
+  if(done()){
+    return true;
+  }
+  uint32_t mark = pixelBytesRead;
+  uint16_t read = readBmpRows(file,header,layout,rowsReady,min<uint16_t>(rows,rowCapacity-rowsReady),
+                              &buffer[(uint32_t)rowsReady*layout.width]);
+  bytesRead += pixelBytesRead-mark;
+  if(read==0){
+    status = IMAGE_ERR_FORMAT;
+    rowCapacity = rowsReady;
+  }
+  rowsReady += read;
+  return done();
+}
+
+ImageReturnCode BmpPrefetch::draw(RenderContext &ctx){
+
+  if(!file.isOpen()||status!=IMAGE_SUCCESS||!visible){
+    file = ImageFile();
+    return status;
+  }
+
+  // Everything that was decoded ahead of time goes out in one transaction
+  uint32_t start = millis();
+  ctx.tft.startWrite();
+  ctx.tft.setAddrWindow(layout.x,layout.y,layout.width,layout.height);
+  if(rowsReady){
+    INSTRUMENT_SCOPE(PROBE_SPI_PUSH);
+    ctx.tft.writePixels(buffer,(uint32_t)rowsReady*layout.width,true,header.raw565);
+  }
+  ctx.tft.endWrite();
+  swapTime = millis()-start;
+
+  // The rest of the image is read from the card as usual
+  uint32_t mark = pixelBytesRead;
+  ImageReturnCode stat = streamRows(ctx,file,header,layout,rowsReady);
+  bytesRead += pixelBytesRead-mark;
+  drawTime = millis()-start;
+  prefetchedRows = rowsReady;
+  file = ImageFile();
+  return stat;
+}
+
+ImageReturnCode BmpPrefetch::drawRows(RenderContext &ctx, int16_t y, uint16_t rows, uint16_t background){
+
+  if(!file.isOpen()){
+    return IMAGE_ERR_FILE_NOT_FOUND;
+  }
+  if(status!=IMAGE_SUCCESS){
+    return status;
+  }
+
+  // Part of the band covered by the picture, the rest is background
+  int16_t end    = y+rows;
+  int16_t top    = visible ? max<int16_t>(y,layout.y) : end;
+  int16_t bottom = visible ? min<int16_t>(end,layout.y+layout.height) : end;
+  if(top>=bottom){
+    top = bottom = end;
+  }
+  int16_t right = layout.x+layout.width;
+  ctx.tft.startWrite();
+  if(top>y){
+    ctx.tft.writeFillRect(0,y,ctx.width,top-y,background);
+  }
+  if(end>bottom){
+    ctx.tft.writeFillRect(0,bottom,ctx.width,end-bottom,background);
+  }
+  if(top<bottom&&layout.x>0){
+    ctx.tft.writeFillRect(0,top,layout.x,bottom-top,background);
+  }
+  if(top<bottom&&right<ctx.width){
+    ctx.tft.writeFillRect(right,top,ctx.width-right,bottom-top,background);
+  }
+  ctx.tft.endWrite();
+
+  // Prefetched rows come from RAM, the others from the card
+  for(int16_t screenRow=top;screenRow<bottom;){
+    uint16_t row = screenRow-layout.y;
+    uint16_t *pixels;
+    uint16_t count;
+    if(row<rowsReady){
+      pixels = &buffer[(uint32_t)row*layout.width];
+      count  = min<uint16_t>(rowsReady-row,bottom-screenRow);
+    }else{
+      pixels = pixelBlock;
+      uint32_t mark = pixelBytesRead;
+      count  = readBmpRows(file,header,layout,row,
+                          min<uint16_t>(bottom-screenRow,blockPixels/layout.width),pixelBlock);
+      bytesRead += pixelBytesRead-mark;
+      if(count==0){
+        status = IMAGE_ERR_FORMAT;
+        return status;
+      }
+    }
+    INSTRUMENT_SCOPE(PROBE_SPI_PUSH);
+    ctx.tft.startWrite();
+    ctx.tft.setAddrWindow(layout.x,screenRow,layout.width,count);
+    ctx.tft.writePixels(pixels,(uint32_t)count*layout.width,true,header.raw565);
+    ctx.tft.endWrite();
+    screenRow += count;
+    workCheckpoint("bmp stream");
+  }
+  return IMAGE_SUCCESS;
+}
+
+void BmpPrefetch::finish(){
+  prefetchedRows = rowsReady;
+  file = ImageFile();
+}
+
+uint32_t bmpBytesRead(){
+  return pixelBytesRead;
+}
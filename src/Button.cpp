@@ -0,0 +1,68 @@
+#include "Button.h"
+
+volatile bool renderAbort = false;
+
+static uint8_t           buttonPin;
+static volatile uint32_t lastEdge = 0; // millis() of the last edge, bounce included
+static volatile uint32_t pressQueue[buttonQueueSize];
+static volatile uint8_t  queueHead = 0; // Written by the interrupt, and by buttonResume() while it is detached
+static volatile uint8_t  queueTail = 0; // Written by buttonPopPress() only
+static volatile uint16_t droppedPresses = 0;
+
+static IRAM_ATTR void queuePress(uint32_t pressedAt){
+  uint8_t next = (queueHead+1)%buttonQueueSize;
+  if(next==queueTail){
+    droppedPresses++;
+    return;
+  }
+  pressQueue[queueHead] = pressedAt;
+  queueHead = next;
+  renderAbort = true;
+}
+
+// Fires on both edges. A falling edge is a press only when the line was
+// quiet before it, the edges of a bouncing contact come too close together.
+static IRAM_ATTR void buttonInterrupt(){
+  uint32_t now = millis();
+  bool quiet = now-lastEdge>=buttonQuietTime;
+  lastEdge = now;
+  if(!quiet||digitalRead(buttonPin)!=LOW){
+    return;
+  }
+  queuePress(now);
+}
+
+void buttonBegin(uint8_t pin){
+  buttonPin = pin;
+  pinMode(pin,INPUT);
+  attachInterrupt(digitalPinToInterrupt(pin),buttonInterrupt,CHANGE);
+}
+
+void buttonResume(){
+  // Light sleep leaves the interrupt attached, take it off so it can't
+  // queue at the same time. The edge can't be queued twice either, the
+  // bounce after it falls within the quiet time.
+  detachInterrupt(digitalPinToInterrupt(buttonPin));
+  if(digitalRead(buttonPin)==LOW&&millis()-lastEdge>=buttonQuietTime){
+    lastEdge = millis();
+    queuePress(lastEdge);
+  }
+  attachInterrupt(digitalPinToInterrupt(buttonPin),buttonInterrupt,CHANGE);
+}
+
+bool buttonPopPress(uint32_t &pressedAt){
+  if(queueTail==queueHead){
+    return false;
+  }
+  pressedAt = pressQueue[queueTail];
+  queueTail = (queueTail+1)%buttonQueueSize;
+  return true;
+}
+
+bool buttonPending(){
+  return queueTail!=queueHead;
+}
+
+uint16_t buttonDroppedPresses(){
+  return droppedPresses;
+}
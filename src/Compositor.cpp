@@ -0,0 +1,209 @@
+#include "Compositor.h"
+#include "Instrument.h"
+
+static uint16_t strip[Compositor::stripPixels]; // Rows of a dirty region being composed
+static uint16_t span[ILI9341_TFTHEIGHT];         // One row of the backdrop
+
+static bool overlaps(const Rect &a, const Rect &b){
+  return a.x<b.x+b.w && b.x<a.x+a.w && a.y<b.y+b.h && b.y<a.y+a.h;
+}
+
+static Rect bounds(const Rect &a, const Rect &b){
+  int16_t x0 = min(a.x,b.x), y0 = min(a.y,b.y);
+  int16_t x1 = max<int16_t>(a.x+a.w,b.x+b.w), y1 = max<int16_t>(a.y+a.h,b.y+b.h);
+  Rect r = {x0, y0, (int16_t)(x1-x0), (int16_t)(y1-y0)};
+  return r;
+}
+
+Compositor::Compositor(SpriteCache &sprites) : pushedPixels(0), sprites(sprites), keyColor(0),
+  screenWidth(0), screenLength(0), layerCount(0), dirtyCount(0), backdrop(), backdropX(0), backdropY(0) {
+  background.color = 0;
+  background.tile = -1;
+}
+
+void Compositor::begin(RenderContext &ctx, const Background &bg, uint16_t key){
+  background   = bg;
+  keyColor     = key;
+  screenWidth  = ctx.width;
+  screenLength = ctx.length;
+  layerCount   = 0;
+  dirtyCount   = 0;
+  backdrop     = ImageFile();
+  pushedPixels = 0;
+  markDirty(0,0,screenWidth,screenLength);
+}
+
+bool Compositor::setBackdrop(ImageFile file, int16_t x, int16_t y){
+  backdrop = ImageFile();
+  if(readBmpHeader(file,backdropHeader)!=IMAGE_SUCCESS){
+    return false;
+  }
+  backdrop  = file;
+  backdropX = x;
+  backdropY = y;
+  markDirty(x,y,backdropHeader.width,backdropHeader.height);
+  return true;
+}
+
+int8_t Compositor::addLayer(int8_t sprite, int16_t x, int16_t y, bool visible){
+  if(layerCount>=maxLayers){
+    return -1;
+  }
+  Layer &layer  = layers[layerCount];
+  layer.sprite  = sprite;
+  layer.x       = x;
+  layer.y       = y;
+  layer.visible = visible;
+  markLayer(layer);
+  return layerCount++;
+}
+
+void Compositor::moveLayer(int8_t id, int16_t x, int16_t y){
+  if(id<0||id>=layerCount){
+    return;
+  }
+  markLayer(layers[id]); // Where it was
+  layers[id].x = x;
+  layers[id].y = y;
+  markLayer(layers[id]); // Where it is now
+}
+
+void Compositor::showLayer(int8_t id, bool visible){
+  if(id<0||id>=layerCount||layers[id].visible==visible){
+    return;
+  }
+  layers[id].visible = visible;
+  const Sprite *sprite = sprites.get(layers[id].sprite);
+  if(sprite){
+    markDirty(layers[id].x,layers[id].y,sprite->width,sprite->height); // Appears or disappears here
+  }
+}
+
+bool Compositor::isVisible(int8_t id) const{
+  return id>=0&&id<layerCount&&layers[id].visible;
+}
+
+void Compositor::markLayer(const Layer &layer){
+  const Sprite *sprite = sprites.get(layer.sprite);
+  if(layer.visible&&sprite){
+    markDirty(layer.x,layer.y,sprite->width,sprite->height);
+  }
+}
+
+void Compositor::markDirty(int16_t x, int16_t y, int16_t w, int16_t h){
+
+  // Clip to the screen
+  if(x<0){ w+=x; x=0; }
+  if(y<0){ h+=y; y=0; }
+  if(x+w>screenWidth){ w=screenWidth-x; }
+  if(y+h>screenLength){ h=screenLength-y; }
+  if(w<=0||h<=0){
+    return;
+  }
+
+  // Grow the new region over every region it overlaps, each merge can
+  // create a new overlap so go over the list again until there are none
+  Rect rect = {x, y, w, h};
+  bool merged = true;
+  while(merged){
+    merged = false;
+    for(uint8_t i=0;i<dirtyCount;i++){
+      if(overlaps(rect,dirty[i])){
+        rect = bounds(rect,dirty[i]);
+        dirty[i] = dirty[--dirtyCount];
+        merged = true;
+        break;
+      }
+    }
+  }
+
+  if(dirtyCount==maxDirty){
+    // Out of slots, fold the last region into this one
+    rect = bounds(rect,dirty[--dirtyCount]);
+  }
+  dirty[dirtyCount++] = rect;
+}
+
+// Composes rows [y, y+rows) of a dirty region into the strip buffer
+void Compositor::compose(RenderContext &ctx, const Rect &rect, int16_t y, int16_t rows){
+
+  INSTRUMENT_SCOPE(PROBE_COMPOSE);
+  // Background
+  const Sprite *tile = sprites.get(background.tile);
+  for(int16_t row=0;row<rows;row++){
+    uint16_t *out = &strip[row*rect.w];
+    if(!tile){
+      for(int16_t col=0;col<rect.w;col++){
+        out[col] = background.color;
+      }
+    }else{
+      const uint16_t *tileRow = &tile->pixels[((y+row)%tile->height)*tile->width];
+      for(int16_t col=0;col<rect.w;col++){
+        out[col] = tileRow[(rect.x+col)%tile->width];
+      }
+    }
+  }
+
+  // Backdrop picture, one row of its overlap at a time
+  BmpLayout layout;
+  if(backdrop.isOpen()&&clipBmp(backdropHeader,backdropX,backdropY,rect.x,y,rect.w,rows,layout)){
+    for(uint16_t row=0;row<layout.height;row++){
+      if(readBmpRows(backdrop,backdropHeader,layout,row,1,span)!=1){
+        break;
+      }
+      uint16_t *out = &strip[(layout.y-y+row)*rect.w+(layout.x-rect.x)];
+      for(uint16_t col=0;col<layout.width;col++){
+        uint16_t c = span[col];
+        out[col] = backdropHeader.raw565 ? (c>>8)|(c<<8) : c; // .565 rows are big endian
+      }
+    }
+  }
+
+  // Layers in the order they were added, keyColor pixels let what is under them show
+  Rect stripRect = {rect.x, y, rect.w, rows};
+  for(uint8_t i=0;i<layerCount;i++){
+    const Sprite *sprite = sprites.get(layers[i].sprite);
+    if(!layers[i].visible||!sprite){
+      continue;
+    }
+    Rect box = {layers[i].x, layers[i].y, (int16_t)sprite->width, (int16_t)sprite->height};
+    if(!overlaps(box,stripRect)){
+      continue;
+    }
+    int16_t x0 = max(box.x,rect.x), x1 = min<int16_t>(box.x+box.w,rect.x+rect.w);
+    int16_t y0 = max(box.y,y),      y1 = min<int16_t>(box.y+box.h,y+rows);
+    for(int16_t sy=y0;sy<y1;sy++){
+      const uint16_t *src = &sprite->pixels[(sy-box.y)*sprite->width+(x0-box.x)];
+      uint16_t *out = &strip[(sy-y)*rect.w+(x0-rect.x)];
+      for(int16_t sx=x0;sx<x1;sx++,src++,out++){
+        if(*src!=keyColor){
+          *out = *src;
+        }
+      }
+    }
+  }
+}
+
+void Compositor::flush(RenderContext &ctx){
+
+  for(uint8_t i=0;i<dirtyCount;i++){
+    const Rect &rect = dirty[i];
+    int16_t stripRows = max<int16_t>(stripPixels/rect.w,1);
+    ctx.tft.startWrite();
+    ctx.tft.setAddrWindow(rect.x,rect.y,rect.w,rect.h);
+    ctx.tft.endWrite();
+    for(int16_t y=rect.y;y<rect.y+rect.h;y+=stripRows){
+      int16_t rows = min<int16_t>(stripRows,rect.y+rect.h-y);
+      compose(ctx,rect,y,rows);
+      // The backdrop may come from the card, only hold the display while pushing
+      {
+        INSTRUMENT_SCOPE(PROBE_SPI_PUSH);
+        ctx.tft.startWrite();
+        ctx.tft.writePixels(strip,(uint32_t)rows*rect.w);
+        ctx.tft.endWrite();
+      }
+      pushedPixels += (uint32_t)rows*rect.w;
+    }
+  }
+  dirtyCount = 0;
+}
@@ -0,0 +1,281 @@
+#include "Config.h"
+#include "Slideshow.h"
+#include "PatternMode.h"
+
+static const uint8_t maxListFields = 6; // Most comma separated values on one line
+
+static const char *transitionNames[] = {"none", "wipe", "push-up", "push-down"};
+static const char *motionNames[]     = {"pop", "drift", "glide"};
+static const char *easingNames[]     = {"linear", "out", "in-out"};
+static const char *modeNames[]       = {"slideshow", "pattern"};
+static const char *powerNames[]      = {"full", "save"};
+
+void configDefaults(DeviceConfig &config){
+  memset(&config,0,sizeof(config));
+  strcpy(config.rootDir,"/");
+  config.startMode        = 0;
+  config.slideshowTime    = slideshowRefreshTime;
+  config.transition       = slideshowTransition;
+  config.downscale        = true;
+  config.convertTo565     = true;
+  config.copyToFlash      = true;
+  config.patternFrameTime = patternFrameTime;
+  config.powerMode        = POWER_FULL;
+  config.backlight        = 100;
+  config.sleepMinutes     = 0;
+}
+
+// Reads one line without its line break, false at the end of the file.
+// The part of a line that doesn't fit is dropped.
+static bool readLine(File32 &file, char *line, uint8_t size){
+  uint8_t length = 0;
+  int c = file.read();
+  if(c<0){
+    return false;
+  }
+  while(c>=0&&c!='\n'){
+    if(c!='\r'&&length+1<size){
+      line[length++] = c;
+    }
+    c = file.read();
+  }
+  line[length] = '\0';
+  return true;
+}
+
+// Strips spaces from both ends in place
+static char *trim(char *text){
+  while(*text==' '||*text=='\t'){
+    text++;
+  }
+  char *end = text+strlen(text);
+  while(end>text&&(end[-1]==' '||end[-1]=='\t')){
+    *--end = '\0';
+  }
+  return text;
+}
+
+// Splits a comma separated value in place, returns the number of fields
+static uint8_t splitList(char *value, char **fields){
+  uint8_t count = 0;
+  while(count<maxListFields){
+    char *comma = strchr(value,',');
+    if(comma){
+      *comma = '\0';
+    }
+    fields[count++] = trim(value);
+    if(!comma){
+      break;
+    }
+    value = comma+1;
+  }
+  return count;
+}
+
+// Position of name in the list of names, -1 when it isn't there
+static int8_t findName(const char *name, const char **names, uint8_t count){
+  for(uint8_t i=0;i<count;i++){
+    if(strcasecmp(name,names[i])==0){
+      return i;
+    }
+  }
+  return -1;
+}
+
+static bool parseNumber(const char *text, uint32_t &value){
+  char *end;
+  unsigned long parsed = strtoul(text,&end,10);
+  if(end==text||*end!='\0'){
+    return false;
+  }
+  value = parsed;
+  return true;
+}
+
+static bool parseBool(const char *text, bool &value){
+  if(strcasecmp(text,"yes")==0||strcasecmp(text,"on")==0||strcmp(text,"1")==0){
+    value = true;
+  }else if(strcasecmp(text,"no")==0||strcasecmp(text,"off")==0||strcmp(text,"0")==0){
+    value = false;
+  }else{
+    return false;
+  }
+  return true;
+}
+
+static bool copyText(char *dst, const char *src, uint8_t size){
+  if(strlen(src)>=size){
+    return false; // Too long, a cut off name would never match
+  }
+  strcpy(dst,src);
+  return true;
+}
+
+// sprite = file, count, motion, speed, duration, easing
+static bool parseSprite(char *value, DeviceConfig &config){
+  char *fields[maxListFields];
+  uint32_t count, speed, duration;
+  if(config.specCount>=Animation::maxSpecs||splitList(value,fields)!=6){
+    return false;
+  }
+  int8_t motion = findName(fields[2],motionNames,sizeof(motionNames)/sizeof(motionNames[0]));
+  int8_t easing = findName(fields[5],easingNames,sizeof(easingNames)/sizeof(easingNames[0]));
+  char *path = config.spritePaths[config.specCount];
+  if(motion<0||easing<0||!copyText(path,fields[0],configPathMax)||
+     !parseNumber(fields[1],count)||count>Animation::maxActors||
+     !parseNumber(fields[3],speed)||speed>0xFFFF||
+     !parseNumber(fields[4],duration)||duration>0xFFFF){
+    return false;
+  }
+  AnimationSpec &spec = config.specs[config.specCount++];
+  spec.spritePath = path;
+  spec.count      = count;
+  spec.motion     = (Motion)motion;
+  spec.speed      = speed;
+  spec.duration   = duration;
+  spec.easing     = (Easing)easing;
+  return true;
+}
+
+// show = name[, time]
+static bool parseShow(char *value, DeviceConfig &config){
+  char *fields[maxListFields];
+  Playlist &playlist = config.playlist;
+  uint8_t count = splitList(value,fields);
+  if(playlist.count>=playlistMax||count>2){
+    return false;
+  }
+  PlaylistItem &item = playlist.items[playlist.count];
+  item.showTime = 0;
+  if(!copyText(item.name,fields[0],playlistNameMax)||(count==2&&!parseNumber(fields[1],item.showTime))){
+    return false;
+  }
+  playlist.count++;
+  return true;
+}
+
+// wifi = network, password. The password is everything after the first comma.
+static bool parseWifi(char *value, DeviceConfig &config){
+  char *comma = strchr(value,',');
+  if(comma){
+    *comma = '\0';
+  }
+  return copyText(config.wifiSsid,trim(value),wifiSsidMax)&&
+         copyText(config.wifiPassword,comma ? trim(comma+1) : "",wifiPasswordMax);
+}
+
+static bool parseSetting(const char *key, char *value, DeviceConfig &config){
+  uint32_t number;
+  int8_t found;
+  if(strcasecmp(key,"mode")==0){
+    found = findName(value,modeNames,sizeof(modeNames)/sizeof(modeNames[0]));
+    config.startMode = found<0 ? config.startMode : found;
+    return found>=0;
+  }
+  if(strcasecmp(key,"dir")==0){
+    return copyText(config.rootDir,value,configPathMax);
+  }
+  if(strcasecmp(key,"cadence")==0){
+    if(!parseNumber(value,number)||number==0){
+      return false;
+    }
+    config.slideshowTime = number;
+    return true;
+  }
+  if(strcasecmp(key,"transition")==0){
+    found = findName(value,transitionNames,sizeof(transitionNames)/sizeof(transitionNames[0]));
+    config.transition = found<0 ? config.transition : (Transition)found;
+    return found>=0;
+  }
+  if(strcasecmp(key,"downscale")==0){
+    return parseBool(value,config.downscale);
+  }
+  if(strcasecmp(key,"convert")==0){
+    return parseBool(value,config.convertTo565);
+  }
+  if(strcasecmp(key,"flash")==0){
+    return parseBool(value,config.copyToFlash);
+  }
+  if(strcasecmp(key,"frame")==0){
+    // The animation steps 33 ms at a time and catches up at most 3 steps a
+    // frame, a shorter period wakes it for nothing and a longer one slows it
+    if(!parseNumber(value,number)||number<Animation::frameTime||number>Animation::frameTime*Animation::maxCatchUp){
+      return false;
+    }
+    config.patternFrameTime = number;
+    return true;
+  }
+  if(strcasecmp(key,"sprite")==0){
+    return parseSprite(value,config);
+  }
+  if(strcasecmp(key,"show")==0){
+    return parseShow(value,config);
+  }
+  if(strcasecmp(key,"wifi")==0){
+    return parseWifi(value,config);
+  }
+  if(strcasecmp(key,"power")==0){
+    found = findName(value,powerNames,sizeof(powerNames)/sizeof(powerNames[0]));
+    config.powerMode = found<0 ? config.powerMode : (PowerMode)found;
+    return found>=0;
+  }
+  if(strcasecmp(key,"backlight")==0){
+    if(!parseNumber(value,number)||number>100){
+      return false;
+    }
+    config.backlight = number;
+    return true;
+  }
+  if(strcasecmp(key,"sleep")==0){
+    if(!parseNumber(value,number)||number>0xFFFF){
+      return false;
+    }
+    config.sleepMinutes = number;
+    return true;
+  }
+  return false;
+}
+
+bool loadConfig(SdFat &sd, const char *path, DeviceConfig &config){
+
+  File32 file = sd.open(path);
+  if(!file){
+    return false;
+  }
+  char line[configLineMax];
+  uint16_t lineNumber = 0, ignored = 0;
+  while(readLine(file,line,sizeof(line))){
+    lineNumber++;
+    char *comment = strchr(line,'#');
+    if(comment){
+      *comment = '\0';
+    }
+    char *text = trim(line);
+    if(*text=='\0'){
+      continue;
+    }
+    char *equals = strchr(text,'=');
+    if(equals){
+      *equals = '\0';
+    }
+    if(!equals||!parseSetting(trim(text),trim(equals+1),config)){
+      Serial.printf("%s line %u not understood, ignored\n",path,lineNumber);
+      ignored++;
+    }
+  }
+  file.close();
+  Serial.printf("Read %s, %u lines ignored\n",path,ignored);
+  return true;
+}
+
+void printConfig(Print &out, const DeviceConfig &config){
+  out.printf("Config: mode %s, dir %s, cadence %lu ms, transition %s, downscale %s\n",
+             modeNames[config.startMode], config.rootDir, (unsigned long)config.slideshowTime,
+             transitionNames[config.transition], config.downscale ? "yes" : "no");
+  out.printf("Config: convert %s, flash %s, pattern frame %lu ms, %u sprite rows, %u playlist pictures\n",
+             config.convertTo565 ? "yes" : "no", config.copyToFlash ? "yes" : "no",
+             (unsigned long)config.patternFrameTime, config.specCount, config.playlist.count);
+  out.printf("Config: wifi %s, power %s, backlight %u%%, display sleep after %u min\n",
+             config.wifiSsid[0] ? config.wifiSsid : "off", powerNames[config.powerMode], config.backlight,
+             config.sleepMinutes);
+}
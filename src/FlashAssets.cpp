@@ -0,0 +1,138 @@
+#include "FlashAssets.h"
+#include "ImageCache.h"
+#include "WorkSlice.h"
+
+static const char *manifestPath = "/assets.idx";    // Which SD file version each flash copy was made from
+static const uint8_t manifestSlots = flashAssetCount+flashSlideCount;
+static const uint32_t flashReserve = 16384;        // Left free so LittleFS always has room to work
+static const uint8_t nameLengthMax = 50;
+
+// Source of a flash copy, a copy is redone when either changes
+struct ManifestSlot {
+  uint32_t stamp; // FAT modification date and time
+  uint32_t size;
+};
+
+static ManifestSlot manifest[manifestSlots];
+static uint8_t copyBuffer[1024];
+static bool mounted = false;
+
+bool flashBegin(){
+  if(!mounted){
+    mounted = LittleFS.begin(); // Formats an empty flash on its own
+    if(!mounted){
+      Serial.println(F("Flash file system not available"));
+    }
+  }
+  return mounted;
+}
+
+bool flashReady(){
+  return mounted;
+}
+
+fs::File flashOpen(const char *path){
+  if(!mounted){
+    return fs::File();
+  }
+  return LittleFS.open(path,"r");
+}
+
+static uint32_t modifyStamp(File32 &file){
+  uint16_t date = 0, time = 0;
+  file.getModifyDateTime(&date,&time);
+  return ((uint32_t)date<<16)|time;
+}
+
+// Copies an SD file to flash unless the copy already matches it
+static bool syncFile(ManifestSlot &slot, File32 &source, const char *flashPath){
+
+  ManifestSlot current = {modifyStamp(source), source.fileSize()};
+  if(slot.stamp==current.stamp&&slot.size==current.size&&LittleFS.exists(flashPath)){
+    return true;
+  }
+
+  FSInfo info;
+  LittleFS.info(info);
+  fs::File old = LittleFS.open(flashPath,"r");
+  uint32_t freeBytes = info.totalBytes-info.usedBytes+(old ? old.size() : 0);
+  old.close();
+  if(current.size+flashReserve>freeBytes){
+    Serial.printf("No room in flash for %s\n",flashPath);
+    return false;
+  }
+
+  uint32_t start = millis();
+  fs::File copy = LittleFS.open(flashPath,"w"); // Creates the directories on the way
+  bool copied = copy&&source.seekSet(0);
+  uint32_t left = current.size;
+  while(copied&&left){
+    int got = source.read(copyBuffer,min<uint32_t>(left,sizeof(copyBuffer)));
+    copied = got>0&&copy.write(copyBuffer,got)==(size_t)got;
+    left -= copied ? got : 0;
+    workCheckpoint("flash copy");
+  }
+  copy.close();
+  if(!copied){
+    Serial.printf("Copying %s to flash failed\n",flashPath);
+    LittleFS.remove(flashPath);
+    slot.stamp = slot.size = 0;
+    return false;
+  }
+  slot = current;
+  Serial.printf("Copied %s to flash, %lu bytes in %lu ms\n",flashPath,
+                (unsigned long)current.size,(unsigned long)(millis()-start));
+  return true;
+}
+
+void flashSync(RenderContext &ctx, const char *dirName){
+
+  if(!mounted){
+    return;
+  }
+  fs::File saved = LittleFS.open(manifestPath,"r");
+  if(!saved||saved.read((uint8_t *)manifest,sizeof(manifest))!=sizeof(manifest)){
+    memset(manifest,0,sizeof(manifest));
+  }
+  saved.close();
+
+  for(uint8_t i=0;i<flashAssetCount;i++){
+    File32 asset = ctx.sd.open(flashAssets[i]);
+    if(asset){
+      syncFile(manifest[i],asset,flashAssets[i]);
+      asset.close();
+    }
+  }
+
+  // The first .565 pictures of the slideshow, in directory order
+  char name[nameLengthMax];
+  char flashPath[24];
+  uint8_t slides = 0;
+  File32 dir = ctx.sd.open(dirName);
+  File32 entry = dir.openNextFile();
+  while(entry&&slides<flashSlideCount){
+    entry.getName(name,nameLengthMax);
+    if(entry.isFile()&&hasExtension(name,".565")){
+      sprintf(flashPath,flashSlidePath,slides);
+      if(syncFile(manifest[flashAssetCount+slides],entry,flashPath)){
+        slides++;
+      }
+    }
+    entry.close();
+    entry = dir.openNextFile();
+  }
+  entry.close();
+  dir.close();
+  // Pictures that are gone from the card are dropped from flash too
+  for(uint8_t i=slides;i<flashSlideCount;i++){
+    sprintf(flashPath,flashSlidePath,i);
+    LittleFS.remove(flashPath);
+    manifest[flashAssetCount+i].stamp = manifest[flashAssetCount+i].size = 0;
+  }
+
+  fs::File updated = LittleFS.open(manifestPath,"w");
+  if(updated){
+    updated.write((const uint8_t *)manifest,sizeof(manifest));
+    updated.close();
+  }
+}
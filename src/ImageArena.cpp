@@ -0,0 +1,58 @@
+#include "ImageArena.h"
+
+static_assert(arenaSize%4==0&&arenaSize>arenaRowBytes+4096,"IMAGE_ARENA_SIZE is too small");
+
+static const size_t imageBytes = arenaSize-arenaRowBytes;
+
+struct PoolState {
+  size_t   used;
+  size_t   highWater;
+  uint16_t failures;
+};
+
+static uint32_t  arena[arenaSize/4]; // Words keep every block aligned
+static uint8_t  *imageArea = (uint8_t *)arena;
+static uint8_t  *rowArea   = imageArea+imageBytes;
+static PoolState pools[POOL_COUNT];
+static const char *poolNames[POOL_COUNT] = {"sprites", "prefetch", "rows"};
+
+size_t arenaAvailable(ArenaPool pool){
+  if(pool==POOL_ROWS){
+    return arenaRowBytes-pools[POOL_ROWS].used;
+  }
+  return imageBytes-pools[POOL_SPRITES].used-pools[POOL_PREFETCH].used;
+}
+
+void *arenaTake(ArenaPool pool, size_t bytes){
+  PoolState &state = pools[pool];
+  bytes = (bytes+3)&~(size_t)3;
+  if(bytes==0||bytes>arenaAvailable(pool)){
+    state.failures++;
+    return NULL;
+  }
+  uint8_t *block;
+  if(pool==POOL_SPRITES){
+    block = imageArea+state.used;
+  }else if(pool==POOL_PREFETCH){
+    block = imageArea+imageBytes-state.used-bytes; // Grows down to meet the sprites
+  }else{
+    block = rowArea+state.used;
+  }
+  state.used += bytes;
+  state.highWater = max(state.highWater,state.used);
+  return block;
+}
+
+void arenaRelease(ArenaPool pool){
+  pools[pool].used = 0;
+}
+
+void arenaReport(Print &out){
+  out.printf("Arena: %lu bytes, %lu for sprites and prefetch, %lu for rows\n", (unsigned long)arenaSize,
+             (unsigned long)imageBytes, (unsigned long)arenaRowBytes);
+  for(uint8_t i=0;i<POOL_COUNT;i++){
+    const PoolState &state = pools[i];
+    out.printf("  %-8s %6lu bytes in use, high water %6lu, %u requests failed\n", poolNames[i],
+               (unsigned long)state.used, (unsigned long)state.highWater, state.failures);
+  }
+}
@@ -0,0 +1,182 @@
+#include "ImageCache.h"
+#include "BmpStream.h"
+#include "WorkSlice.h"
+#include "ImageArena.h"
+
+static const uint8_t nameLengthMax = 50; // Longest file name handled
+
+// Pixels converted at a time, from the arena's rows pool
+static const uint16_t convertPixels = ILI9341_TFTHEIGHT*4;
+
+bool hasExtension(const char *name, const char *ext){
+  size_t nameLength = strlen(name);
+  size_t extLength  = strlen(ext);
+  return nameLength>extLength && strcasecmp(name+nameLength-extLength,ext)==0;
+}
+
+bool swapExtension(char *name, size_t size, const char *ext){
+  char *dot = strrchr(name,'.');
+  if(!dot||(size_t)(dot-name)+strlen(ext)+1>size){
+    return false;
+  }
+  strcpy(dot,ext);
+  return true;
+}
+
+// Opens a file by name inside dir without losing the dir's place in an
+// openNextFile() walk, a lookup by name rewinds the directory
+static bool openInDir(File32 &dir, File32 &file, const char *name, oflag_t oflag){
+  uint32_t position = dir.curPosition();
+  bool opened = file.open(&dir,name,oflag);
+  dir.seekSet(position);
+  return opened;
+}
+
+// Every copy ends with the size and the FAT modification date and time of
+// the BMP it was made from, a BMP replaced by any other file shows up as a
+// mismatch even when its date is older or the board wrote it undated
+static const uint8_t cacheTrailerSize = 8;
+
+static void sourceTrailer(File32 &bmp, uint8_t trailer[cacheTrailerSize]){
+  uint16_t date = 0, time = 0;
+  bmp.getModifyDateTime(&date,&time);
+  uint32_t size = bmp.fileSize();
+  uint8_t values[cacheTrailerSize] = {
+    (uint8_t)size, (uint8_t)(size>>8), (uint8_t)(size>>16), (uint8_t)(size>>24),
+    (uint8_t)time, (uint8_t)(time>>8), (uint8_t)date, (uint8_t)(date>>8)
+  };
+  memcpy(trailer,values,cacheTrailerSize);
+}
+
+bool openCachedImage(File32 &dir, File32 &entry, File32 &cache){
+  char name[nameLengthMax];
+  entry.getName(name,nameLengthMax);
+  if(!hasExtension(name,".bmp")||!swapExtension(name,nameLengthMax,".565")){
+    return false;
+  }
+  if(!openInDir(dir,cache,name,O_RDONLY)){
+    return false;
+  }
+  // Copies without the trailer, cut short or made from another BMP are stale
+  BmpHeader header;
+  uint8_t stored[cacheTrailerSize], expected[cacheTrailerSize];
+  uint32_t pixelBytes = 0;
+  if(readBmpHeader(cache,header)==IMAGE_SUCCESS&&header.raw565){
+    pixelBytes = (uint32_t)header.width*header.height*2;
+  }
+  sourceTrailer(entry,expected);
+  bool current = pixelBytes>0&&cache.fileSize()==raw565HeaderSize+pixelBytes+cacheTrailerSize&&
+                 cache.seekSet(raw565HeaderSize+pixelBytes)&&
+                 cache.read(stored,cacheTrailerSize)==cacheTrailerSize&&
+                 memcmp(stored,expected,cacheTrailerSize)==0;
+  if(!current){
+    cache.close(); // The BMP changed since it was converted
+    return false;
+  }
+  cache.seekSet(0);
+  return true;
+}
+
+bool isCacheOfBmp(File32 &dir, File32 &entry){
+  char name[nameLengthMax];
+  entry.getName(name,nameLengthMax);
+  if(!hasExtension(name,".565")||!swapExtension(name,nameLengthMax,".bmp")){
+    return false;
+  }
+  File32 bmp;
+  bool found = openInDir(dir,bmp,name,O_RDONLY);
+  bmp.close();
+  return found;
+}
+
+// Writes the .565 copy of one BMP, followed by the trailer of its source
+static bool convertImage(RenderContext &ctx, File32 &dir, File32 &bmp, const char *cacheName, uint16_t *convertRows){
+
+  // Oversized pictures are stored already shrunk to fit, so they load as
+  // fast as any other screen sized picture
+  BmpHeader header;
+  BmpLayout layout;
+  if(readBmpHeader(bmp,header)!=IMAGE_SUCCESS||header.raw565){
+    return false;
+  }
+  uint8_t scale = bmpFitScale(ctx,header);
+  if(!clipBmp(header,0,0,0,0,ctx.width,ctx.length,layout,scale)||
+     layout.width!=header.width/scale||layout.height!=header.height/scale){
+    return false; // Unsupported or doesn't fit on the screen
+  }
+
+  File32 cache;
+  if(!openInDir(dir,cache,cacheName,O_WRONLY|O_CREAT|O_TRUNC)){
+    return false;
+  }
+  uint8_t head[raw565HeaderSize] = {
+    raw565Magic&0xFF, (raw565Magic>>8)&0xFF, (raw565Magic>>16)&0xFF, raw565Magic>>24,
+    (uint8_t)(layout.width&0xFF), (uint8_t)(layout.width>>8),
+    (uint8_t)(layout.height&0xFF), (uint8_t)(layout.height>>8)
+  };
+  bool ok = cache.write(head,sizeof(head))==sizeof(head);
+
+  const uint16_t maxRows = convertPixels/layout.width;
+  uint16_t row = 0;
+  while(ok&&row<layout.height){
+    uint16_t rows = readBmpRows(bmp,header,layout,row,maxRows,convertRows);
+    if(rows==0){
+      ok = false;
+      break;
+    }
+    // Store big endian, the byte order the display takes
+    uint32_t count = (uint32_t)rows*layout.width;
+    for(uint32_t i=0;i<count;i++){
+      convertRows[i] = (convertRows[i]>>8)|(convertRows[i]<<8);
+    }
+    ok = cache.write(convertRows,count*2)==count*2;
+    row += rows;
+    workCheckpoint("convert");
+  }
+
+  if(ok){
+    uint8_t trailer[cacheTrailerSize];
+    sourceTrailer(bmp,trailer);
+    ok = cache.write(trailer,cacheTrailerSize)==cacheTrailerSize;
+  }
+  if(!ok){
+    cache.remove(); // Don't leave a half written copy behind
+    return false;
+  }
+  cache.close();
+  return true;
+}
+
+void convertImagesTo565(RenderContext &ctx, const char *dirName){
+
+  char name[nameLengthMax];
+  uint16_t converted = 0;
+  uint16_t *convertRows = arenaTake<uint16_t>(POOL_ROWS,convertPixels);
+  if(!convertRows){
+    Serial.println(F("No room in the arena to convert pictures"));
+    return;
+  }
+  File32 dir = ctx.sd.open(dirName);
+  File32 entry = dir.openNextFile();
+  while(entry){
+    entry.getName(name,nameLengthMax);
+    File32 cache;
+    if(entry.isFile()&&hasExtension(name,".bmp")){
+      if(openCachedImage(dir,entry,cache)){
+        cache.close(); // Already up to date
+      }else if(swapExtension(name,nameLengthMax,".565")){
+        Serial.print(F("Converting to "));
+        Serial.println(name);
+        if(convertImage(ctx,dir,entry,name,convertRows)){
+          converted++;
+        }
+      }
+    }
+    entry.close();
+    workCheckpoint("convert");
+    entry = dir.openNextFile();
+  }
+  dir.close();
+  arenaRelease(POOL_ROWS);
+  Serial.printf("%u pictures converted to .565\n",converted);
+}
@@ -0,0 +1,169 @@
+#include "ImageIndex.h"
+#include "Instrument.h"
+#include "BmpStream.h"
+#include "ImageCache.h"
+#include "JpegStream.h"
+#include "FlashAssets.h"
+#include "WorkSlice.h"
+
+static const uint8_t nameLengthMax = 50; // Longest file name handled
+
+ImageIndex::ImageIndex() : playlist(NULL), imageCount(0), flash(false) {}
+
+// Playlist item naming the file, notListed when there is none
+static uint8_t findInPlaylist(const Playlist &playlist, const char *name){
+  for(uint8_t i=0;i<playlist.count;i++){
+    if(strcasecmp(playlist.items[i].name,name)==0){
+      return i;
+    }
+  }
+  return ImageIndex::notListed;
+}
+
+uint16_t ImageIndex::build(RenderContext &ctx, const char *dirName, const Playlist *list){
+
+  close();
+  imageCount = 0;
+  flash = false;
+  playlist = list&&list->count ? list : NULL;
+  dir.close();
+  if(!dir.open(dirName,O_RDONLY)){
+    Serial.println(F("Slideshow directory not found"));
+    return 0;
+  }
+
+  File32 entry, cache;
+  BmpHeader header;
+  char name[nameLengthMax];
+  bool valid;
+  uint16_t skipped = 0;
+  while(entry.openNext(&dir,O_RDONLY)){
+
+    if(!entry.isFile()||isCacheOfBmp(dir,entry)){
+      entry.close(); // Directories and .565 copies shown through their BMP
+      continue;
+    }
+    entry.getName(name,nameLengthMax);
+    if(hasExtension(name,".tmp")){
+      entry.close(); // A pushed picture cut off before it was renamed
+      continue;
+    }
+    uint8_t slot = playlist ? findInPlaylist(*playlist,name) : notListed;
+    if(playlist&&slot==notListed){
+      entry.close(); // Not on the playlist
+      continue;
+    }
+    if(imageCount>=maxImages){
+      Serial.println(F("Too many pictures, the rest are left out"));
+      entry.close();
+      break;
+    }
+
+    ImageIndexEntry &indexed = entries[imageCount];
+    indexed.dirIndex     = entry.dirIndex();
+    indexed.cacheIndex   = noCache;
+    indexed.slow         = false;
+    indexed.drawTime     = 0;
+    indexed.playlistSlot = slot;
+    if(openCachedImage(dir,entry,cache)){
+      indexed.cacheIndex = cache.dirIndex();
+      cache.close();
+    }
+
+    if(hasExtension(name,".jpg")||hasExtension(name,".jpeg")){
+      indexed.format = FORMAT_JPEG;
+      valid = readJpegSize(entry,indexed.width,indexed.height);
+    }else{
+      indexed.format = FORMAT_BMP;
+      valid = readBmpHeader(entry,header)==IMAGE_SUCCESS;
+      if(valid){
+        indexed.width  = header.width;
+        indexed.height = header.height;
+      }
+    }
+    if(valid){
+      imageCount++;
+    }else{
+      skipped++;
+    }
+    entry.close();
+    workCheckpoint("index scan");
+  }
+
+  if(playlist){
+    // Directory order to playlist order, a plain insertion sort is plenty once at boot
+    for(uint16_t i=1;i<imageCount;i++){
+      ImageIndexEntry moved = entries[i];
+      uint16_t j = i;
+      for(;j>0&&entries[j-1].playlistSlot>moved.playlistSlot;j--){
+        entries[j] = entries[j-1];
+      }
+      entries[j] = moved;
+    }
+    Serial.printf("Playlist: %u of its %u pictures found\n",imageCount,playlist->count);
+  }
+
+  Serial.printf("Indexed %u pictures, skipped %u other files\n",imageCount,skipped);
+  return imageCount;
+}
+
+uint16_t ImageIndex::buildFromFlash(){
+
+  close();
+  imageCount = 0;
+  flash = true;
+  playlist = NULL; // The slides are numbered, the playlist names don't apply
+  dir.close();
+
+  char path[24];
+  BmpHeader header;
+  for(uint8_t n=0;n<flashSlideCount;n++){
+    sprintf(path,flashSlidePath,n);
+    fs::File slide = flashOpen(path);
+    if(slide&&readBmpHeader(slide,header)==IMAGE_SUCCESS){
+      ImageIndexEntry &indexed = entries[imageCount++];
+      indexed.dirIndex     = n; // The slide number
+      indexed.cacheIndex   = noCache;
+      indexed.width        = header.width;
+      indexed.height       = header.height;
+      indexed.format       = FORMAT_BMP;
+      indexed.slow         = false;
+      indexed.drawTime     = 0;
+      indexed.playlistSlot = notListed;
+    }
+    slide.close();
+  }
+  Serial.printf("Indexed %u pictures in flash\n",imageCount);
+  return imageCount;
+}
+
+uint32_t ImageIndex::showTime(uint16_t i) const{
+  if(!playlist||i>=imageCount||entries[i].playlistSlot==notListed){
+    return 0;
+  }
+  return playlist->items[entries[i].playlistSlot].showTime;
+}
+
+ImageFile ImageIndex::open(uint16_t i){
+  INSTRUMENT_SCOPE(PROBE_SD_OPEN);
+  close();
+  if(i>=imageCount){
+    return ImageFile();
+  }
+  const ImageIndexEntry &indexed = entries[i];
+  if(flash){
+    char path[24];
+    sprintf(path,flashSlidePath,indexed.dirIndex);
+    currentFlash = flashOpen(path);
+    return currentFlash ? ImageFile(currentFlash) : ImageFile();
+  }
+  if(indexed.cacheIndex!=noCache&&current.open(&dir,indexed.cacheIndex,O_RDONLY)){
+    return ImageFile(current);
+  }
+  return current.open(&dir,indexed.dirIndex,O_RDONLY) ? ImageFile(current) : ImageFile();
+}
+
+void ImageIndex::close(){
+  current.close();
+  currentFlash.close();
+}
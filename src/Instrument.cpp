@@ -0,0 +1,72 @@
+#include "Instrument.h"
+
+#ifdef ENABLE_INSTRUMENTATION
+
+static const char *probeNames[PROBE_COUNT] = {
+  "sd_open", "header", "pixel_read", "spi_push", "cell_search", "compose"
+};
+
+struct ProbeStats {
+  uint32_t count;
+  uint64_t total;
+  uint32_t min, max;
+  uint16_t buckets[probeBuckets];
+  uint32_t recent[probeRecentSize];
+  uint8_t  recentHead;
+};
+
+static ProbeStats stats[PROBE_COUNT];
+
+void instrumentRecord(Probe probe, uint32_t cycles){
+  ProbeStats &s = stats[probe];
+  if(s.count==0||cycles<s.min){
+    s.min = cycles;
+  }
+  if(cycles>s.max){
+    s.max = cycles;
+  }
+  s.count++;
+  s.total += cycles;
+
+  uint8_t bucket = cycles ? 31-__builtin_clz(cycles) : 0;
+  if(bucket>=probeBuckets){
+    bucket = probeBuckets-1;
+  }
+  if(s.buckets[bucket]<0xFFFF){
+    s.buckets[bucket]++;
+  }
+  s.recent[s.recentHead] = cycles;
+  s.recentHead = (s.recentHead+1)%probeRecentSize;
+}
+
+void instrumentDump(Print &out){
+  const uint32_t cyclesPerUs = ESP.getCpuFreqMHz();
+  for(uint8_t p=0;p<PROBE_COUNT;p++){
+    const ProbeStats &s = stats[p];
+    if(s.count==0){
+      continue;
+    }
+    out.printf("probe %s: n=%lu min=%luus avg=%luus max=%luus\n", probeNames[p], (unsigned long)s.count,
+               (unsigned long)(s.min/cyclesPerUs), (unsigned long)(s.total/s.count/cyclesPerUs),
+               (unsigned long)(s.max/cyclesPerUs));
+    out.print(F("  histogram (log2 cycles:count)"));
+    for(uint8_t b=0;b<probeBuckets;b++){
+      if(s.buckets[b]){
+        out.printf(" %u:%u",b,s.buckets[b]);
+      }
+    }
+    out.print(F("\n  recent us"));
+    uint8_t recentCount = min<uint32_t>(s.count,probeRecentSize);
+    for(uint8_t i=0;i<recentCount;i++){
+      uint8_t index = (s.recentHead+probeRecentSize-recentCount+i)%probeRecentSize;
+      out.printf(" %lu",(unsigned long)(s.recent[index]/cyclesPerUs));
+    }
+    out.println();
+  }
+}
+
+void instrumentReset(){
+  memset(stats,0,sizeof(stats));
+}
+
+#endif
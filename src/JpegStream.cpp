@@ -0,0 +1,151 @@
+#include "JpegStream.h"
+#include "BmpStream.h"
+#include "Instrument.h"
+#include "WorkSlice.h"
+#include <JPEGDEC.h>
+#include <new>
+
+static JPEGDEC *decoder = NULL;
+static uint32_t bytesRead = 0;
+
+static uint16_t readBE16(ImageFile &file){
+  uint8_t b[2] = {0,0};
+  file.read(b,2);
+  return (b[0]<<8) | b[1];
+}
+
+bool readJpegSize(ImageFile file, uint16_t &width, uint16_t &height){
+
+  if(!file.isFile()||!file.seekSet(0)||readBE16(file)!=0xFFD8){ // Start of image
+    return false;
+  }
+  while(true){
+    int marker = file.read();
+    if(marker!=0xFF){
+      return false;
+    }
+    do{
+      marker = file.read(); // Markers may be padded with extra 0xFF
+    }while(marker==0xFF);
+    if(marker<0||marker==0xD9||marker==0xDA){
+      return false; // Reached the picture data without a frame header
+    }
+    if(marker==0x01||(marker>=0xD0&&marker<=0xD7)){
+      continue; // Markers without a payload
+    }
+    uint16_t length = readBE16(file);
+    if(length<2){
+      return false;
+    }
+    if(marker==0xC0||marker==0xC1){ // Baseline and extended sequential frames
+      file.read();                  // Sample precision
+      height = readBE16(file);
+      width  = readBE16(file);
+      return width&&height;
+    }
+    if(marker>=0xC2&&marker<=0xCF&&marker!=0xC4&&marker!=0xC8&&marker!=0xCC){
+      return false; // Progressive, lossless or arithmetic coded
+    }
+    if(!file.seekCur(length-2)){
+      return false;
+    }
+  }
+}
+
+static int32_t readFile(JPEGFILE *jpegFile, uint8_t *buffer, int32_t length){
+  int got = ((ImageFile *)jpegFile->fHandle)->read(buffer,length);
+  if(got>0){
+    bytesRead += got;
+  }
+  return got;
+}
+
+static int32_t seekFile(JPEGFILE *jpegFile, int32_t position){
+  return ((ImageFile *)jpegFile->fHandle)->seekSet(position) ? position : -1;
+}
+
+// Pushes one decoded strip, the SD card is only deselected while it goes out
+static int pushStrip(JPEGDRAW *strip){
+  if(bmpAbortRequested()){
+    return 0; // Stops the decoder
+  }
+  workCheckpoint("jpeg");
+  RenderContext &ctx = *(RenderContext *)strip->pUser;
+  int16_t visible = min<int16_t>(strip->iWidth,ctx.width-strip->x);
+  int16_t rows    = min<int16_t>(strip->iHeight,ctx.length-strip->y);
+  if(visible<=0||rows<=0){
+    return 1;
+  }
+  INSTRUMENT_SCOPE(PROBE_SPI_PUSH);
+  ctx.tft.startWrite();
+  ctx.tft.setAddrWindow(strip->x,strip->y,visible,rows);
+  if(visible==strip->iWidth){
+    ctx.tft.writePixels(strip->pPixels,(uint32_t)visible*rows,true,true);
+  }else{
+    // The last MCU column sticks out of the screen, push the rows one by one
+    for(int16_t row=0;row<rows;row++){
+      ctx.tft.writePixels(&strip->pPixels[row*strip->iWidth],visible,true,true);
+    }
+  }
+  ctx.tft.endWrite();
+  return 1;
+}
+
+ImageReturnCode drawJpegCentered(RenderContext &ctx, ImageFile file, uint16_t background){
+
+  bytesRead = 0;
+  if(!decoder){
+    decoder = new (std::nothrow) JPEGDEC;
+    if(!decoder){
+      return IMAGE_ERR_MALLOC;
+    }
+  }
+  if(!file.seekSet(0)||!decoder->open(&file,file.fileSize(),NULL,readFile,seekFile,pushStrip)){
+    return IMAGE_ERR_FORMAT;
+  }
+  decoder->setPixelType(RGB565_BIG_ENDIAN); // The display's byte order
+  decoder->setUserPointer(&ctx);
+
+  // Smallest reduction the decoder offers that fits the screen
+  static const int scaleOptions[] = {0, JPEG_SCALE_HALF, JPEG_SCALE_QUARTER, JPEG_SCALE_EIGHTH};
+  uint8_t shift = 0;
+  while(shift<3&&((decoder->getWidth()>>shift)>ctx.width||(decoder->getHeight()>>shift)>ctx.length)){
+    shift++;
+  }
+  int16_t x = max<int16_t>((ctx.width-(decoder->getWidth()>>shift))/2,0);
+  int16_t y = max<int16_t>((ctx.length-(decoder->getHeight()>>shift))/2,0);
+
+  // Strips only cover the picture, clear what the old one leaves around it
+  int16_t right  = min<int16_t>(x+(decoder->getWidth()>>shift),ctx.width);
+  int16_t bottom = min<int16_t>(y+(decoder->getHeight()>>shift),ctx.length);
+  ctx.tft.startWrite();
+  if(y>0){
+    ctx.tft.writeFillRect(0,0,ctx.width,y,background);
+  }
+  if(bottom<ctx.length){
+    ctx.tft.writeFillRect(0,bottom,ctx.width,ctx.length-bottom,background);
+  }
+  if(x>0){
+    ctx.tft.writeFillRect(0,y,x,bottom-y,background);
+  }
+  if(right<ctx.width){
+    ctx.tft.writeFillRect(right,y,ctx.width-right,bottom-y,background);
+  }
+  ctx.tft.endWrite();
+
+  int decoded = decoder->decode(x,y,scaleOptions[shift]);
+  decoder->close();
+  if(!decoded&&!bmpAbortRequested()){
+    return IMAGE_ERR_FORMAT;
+  }
+  return IMAGE_SUCCESS;
+}
+
+uint32_t jpegBytesRead(){
+  return bytesRead;
+}
+
+void jpegRelease(){
+  delete decoder;
+  decoder = NULL;
+}
@@ -0,0 +1,144 @@
+#include "ModeManager.h"
+
+ModeManager::ModeManager(Scheduler &scheduler, size_t warmBudget) : scheduler(scheduler), budget(warmBudget),
+  modeCount(0), currentMode(0), warmTask(-1), active(false) {}
+
+int8_t ModeManager::add(const ModeHooks &hooks){
+  if(modeCount>=maxModes){
+    return -1;
+  }
+  Mode &mode      = modes[modeCount];
+  mode.hooks      = hooks;
+  mode.taskCount  = 0;
+  mode.loaded     = false;
+  mode.warming    = false;
+  mode.switchTime = 0;
+  return modeCount++;
+}
+
+void ModeManager::addTask(int8_t mode, int8_t taskId){
+  if(mode>=0&&mode<modeCount&&modes[mode].taskCount<maxModeTasks){
+    modes[mode].tasks[modes[mode].taskCount++] = taskId;
+  }
+}
+
+// Whether the mode can stay in memory while another one is shown
+bool ModeManager::keepWarm(uint8_t mode) const{
+  if(!modes[mode].hooks.release){
+    return true; // Holds nothing worth freeing
+  }
+  return modes[mode].hooks.warmBytes<=budget;
+}
+
+void ModeManager::releaseMode(uint8_t mode){
+  Mode &m = modes[mode];
+  if((m.loaded||m.warming)&&m.hooks.release){
+    m.hooks.release();
+  }
+  m.loaded  = false;
+  m.warming = false;
+}
+
+void ModeManager::enter(RenderContext &ctx, uint8_t mode){
+
+  if(modeCount==0){
+    return;
+  }
+  if(mode>=modeCount){
+    mode = 0;
+  }
+  uint32_t start = millis();
+  if(active){
+    Mode &from = modes[currentMode];
+    for(uint8_t i=0;i<from.taskCount;i++){
+      scheduler.disable(from.tasks[i]);
+    }
+    from.hooks.exit();
+  }
+
+  // Only the mode after the new one stays loaded, the one just left
+  // included when it comes next
+  uint8_t next = (mode+1)%modeCount;
+  for(uint8_t i=0;i<modeCount;i++){
+    if(i==mode){
+      continue;
+    }
+    if(i!=next||!keepWarm(i)){
+      releaseMode(i);
+    }
+  }
+
+  Mode &to = modes[mode];
+  bool wasLoaded = to.loaded;
+  currentMode = mode;
+  active      = true;
+  to.hooks.enter(ctx);
+  to.loaded  = true;
+  to.warming = false;
+  for(uint8_t i=0;i<to.taskCount;i++){
+    scheduler.enable(to.tasks[i]);
+  }
+  to.switchTime = millis()-start;
+  Serial.printf("Mode %s in %lu ms%s\n", to.hooks.name, (unsigned long)to.switchTime,
+                wasLoaded ? ", was loaded" : "");
+
+  // Warm the next mode once the new one had time to settle
+  if(next!=mode&&!modes[next].loaded&&modes[next].hooks.warm&&keepWarm(next)&&warmTask>=0){
+    scheduler.enable(warmTask);
+    scheduler.runIn(warmTask,warmDelay);
+  }
+}
+
+void ModeManager::suspend(){
+  if(!active){
+    return;
+  }
+  Mode &mode = modes[currentMode];
+  for(uint8_t i=0;i<mode.taskCount;i++){
+    scheduler.disable(mode.tasks[i]);
+  }
+  mode.hooks.exit();
+  active = false;
+}
+
+void ModeManager::advance(RenderContext &ctx, uint8_t steps){
+  if(modeCount){
+    enter(ctx,(currentMode+steps)%modeCount);
+  }
+}
+
+bool ModeManager::warmStep(RenderContext &ctx){
+
+  if(!active||modeCount<2){
+    return false;
+  }
+  uint8_t next = (currentMode+1)%modeCount;
+  Mode &mode = modes[next];
+  if(mode.loaded||!mode.hooks.warm||!keepWarm(next)){
+    return false;
+  }
+  // Don't start on it unless its pool still has the room, the shown mode
+  // may be using the same part of the arena
+  if(!mode.warming&&arenaAvailable(mode.hooks.warmPool)<mode.hooks.warmBytes){
+    Serial.printf("Not enough memory to keep mode %s loaded\n",mode.hooks.name);
+    return false;
+  }
+  mode.warming = true;
+  if(mode.hooks.warm(ctx)){
+    mode.loaded  = true;
+    mode.warming = false;
+    return false;
+  }
+  return true;
+}
+
+void ModeManager::printStats(Print &out) const{
+  for(uint8_t i=0;i<modeCount;i++){
+    const Mode &mode = modes[i];
+    out.printf("Mode %u %-10s %s, last switch %lu ms, warms %lu of %lu arena bytes free\n", i, mode.hooks.name,
+               i==currentMode&&active ? "shown" : mode.loaded ? "loaded" : mode.warming ? "loading" : "released",
+               (unsigned long)mode.switchTime, (unsigned long)mode.hooks.warmBytes,
+               (unsigned long)arenaAvailable(mode.hooks.warmPool));
+  }
+  out.printf("Warm budget %lu arena bytes\n", (unsigned long)budget);
+}
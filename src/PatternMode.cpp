@@ -0,0 +1,91 @@
+#include "PatternMode.h"
+#include "Animation.h"
+#include "Colors.h"
+#include "FlashAssets.h"
+
+static const uint16_t spriteGap = 2; // Minimum space between two popping sprites
+static const uint16_t messageHeight = 100; // Height of the message sprite
+static const char *atlasPath   = "/pattern/sprites.atl"; // Packed sprites, the BMPs are used when it is missing
+static const char *messagePath = "/pattern/bottom-message.bmp";
+
+// What the animation shows, one row per group of sprites. Sprites are
+// looked up in the atlas by file name first.
+static const AnimationSpec patternContent[] = {
+  // sprite                count  motion        speed  duration  easing
+  {"/pattern/heart.bmp",   24,    MOTION_POP,   0,     500,      EASE_LINEAR}, // Hearts popping in and out above the message
+  {"/pattern/heart.bmp",   2,     MOTION_GLIDE, 0,     3000,     EASE_IN_OUT}, // A couple wandering over the whole screen
+};
+
+static const AnimationSpec *content = patternContent;
+static uint8_t contentCount = sizeof(patternContent)/sizeof(patternContent[0]);
+
+static SpriteCache patternSprites; // Sprites used by the animation
+static Compositor  compositor(patternSprites);
+static Animation   animation(compositor,patternSprites);
+static const Background background = {BLACK, -1};
+static const uint16_t transparentColor = BLACK; // Sprite pixels of this color show what is under them
+static File32   message;      // Kept open, the compositor reads it back wherever a sprite overlaps it
+static fs::File flashMessage; // The same from flash, used first when there is a copy
+static bool     loaded = false;
+
+bool patternWarm(RenderContext &ctx){
+
+  if(loaded){
+    return true;
+  }
+  // Assets come from flash when they were copied there, reading them
+  // doesn't hold up the SPI bus and works without an SD card
+  flashMessage = flashOpen(messagePath);
+  if(!flashMessage){
+    message = ctx.sd.open(messagePath);
+  }
+
+  // Decode the animation sprites once, every frame after this only costs SPI time
+  fs::File flashAtlas = flashOpen(atlasPath);
+  uint8_t packed = flashAtlas ? patternSprites.loadAtlas(flashAtlas) : patternSprites.loadAtlas(ctx,atlasPath);
+  flashAtlas.close();
+  if(packed==0){
+    Serial.println(F("No sprite atlas, loading the pattern BMPs"));
+  }
+  for(uint8_t i=0;i<contentCount;i++){
+    if(patternSprites.find(content[i].spritePath)<0){
+      patternSprites.load(ctx,content[i].spritePath);
+    }
+  }
+  loaded = true;
+  return true;
+}
+
+void patternEnter(RenderContext &ctx){
+
+  patternWarm(ctx);
+  compositor.begin(ctx,background,transparentColor); // Sets the background
+  ImageFile backdrop = flashMessage ? ImageFile(flashMessage) : ImageFile(message);
+  if(!compositor.setBackdrop(backdrop,-5,220)){ // Manual offset due to the text not being quite centered...
+    Serial.println(F("Message picture not found"));
+  }
+  const Rect popArea = {0, 0, (int16_t)ctx.width, (int16_t)(ctx.length-messageHeight)};
+  animation.begin(ctx,content,contentCount,popArea,spriteGap);
+  compositor.flush(ctx); // Draws the whole screen once
+}
+
+void patternSetContent(const AnimationSpec *specs, uint8_t specCount){
+  patternRelease(); // The sprites of the old table may not be needed any more
+  content = specs;
+  contentCount = specCount;
+}
+
+void patternStep(RenderContext &ctx){
+  animation.frame(ctx);
+}
+
+void patternExit(){
+  // The sprites and message stay loaded for the next time, patternRelease() frees them
+}
+
+void patternRelease(){
+  message.close();
+  flashMessage.close();
+  patternSprites.clear(); // Hand the memory back to the slideshow
+  loaded = false;
+}
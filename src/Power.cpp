@@ -0,0 +1,219 @@
+#include "Power.h"
+#include "Pins.h"
+#include "WorkSlice.h"
+#include <ESP8266WiFi.h>
+extern "C" {
+#include "user_interface.h"
+}
+
+static const int8_t  backlightPin = TFT_LED;
+static const uint8_t idleModeOn   = 0x39; // IDMON, Adafruit_ILI9341.h doesn't name it
+static const uint8_t idleModeOff  = 0x38; // IDMOFF
+
+static PowerMode      mode      = POWER_FULL;
+static bool           wifiOn    = false;
+static uint8_t        wakePin   = 0;
+static void         (*wakeHook)() = NULL;
+static volatile bool *wakeFlag  = NULL;
+static volatile bool  timerWoke = false; // Set by the SDK when a light sleep ends
+static uint8_t        backlight = 100;
+static bool           displayAsleep = false;
+static uint32_t       missedMs  = 0;     // Light sleep millis() didn't count
+
+// Stats since the last reset, on the powerMillis() clock
+static uint32_t statsStart      = 0;
+static uint32_t idleMs          = 0;
+static uint32_t sleepMs         = 0;
+static uint32_t sleeps          = 0;
+static uint32_t displayOffMs    = 0;
+static uint32_t displayOffSince = 0;
+
+static bool wakeRequested(){
+  return wakeFlag&&*wakeFlag;
+}
+
+static bool backlightDimmed(){
+  return backlightPin>=0&&!displayAsleep&&backlight>0&&backlight<100;
+}
+
+static void writeBacklight(){
+  if(backlightPin<0){
+    return;
+  }
+  uint8_t level = displayAsleep ? 0 : backlight;
+  if(level>0&&level<100){
+    analogWrite(backlightPin,level);
+  }else{
+    analogWrite(backlightPin,0); // Stops the PWM, a steady level keeps working in light sleep
+    digitalWrite(backlightPin,level ? HIGH : LOW);
+  }
+}
+
+void powerBegin(PowerMode powerMode, bool wifiUsed, uint8_t pin, void (*onWake)()){
+  mode     = powerMode;
+  wifiOn   = wifiUsed;
+  wakePin  = pin;
+  wakeHook = onWake;
+  if(mode==POWER_SAVE){
+    if(wifiOn){
+      WiFi.setSleepMode(WIFI_MODEM_SLEEP,wifiListenInterval);
+    }else{
+      WiFi.mode(WIFI_OFF); // Light sleep needs the radio off
+    }
+  }
+  if(backlightPin>=0){
+    pinMode(backlightPin,OUTPUT);
+    analogWriteRange(100); // Levels in percent
+    writeBacklight();
+  }
+  powerReset();
+}
+
+void powerSetWakeFlag(volatile bool *flag){
+  wakeFlag = flag;
+}
+
+PowerMode powerMode(){
+  return mode;
+}
+
+uint32_t powerMillis(){
+  return millis()+missedMs;
+}
+
+static void sleepEnded(){
+  timerWoke = true;
+}
+
+static bool canLightSleep(uint32_t ms){
+  return mode==POWER_SAVE&&!wifiOn&&ms>=lightSleepMin&&!wakeRequested()&&
+         !backlightDimmed()&&digitalRead(wakePin)==HIGH;
+}
+
+// Forced light sleep for up to ms, ended early by the wake pin going low
+static void lightSleep(uint32_t ms){
+  uint32_t rtcStart = system_get_rtc_time();
+  uint32_t began    = millis();
+  timerWoke = false;
+  wifi_fpm_set_sleep_type(LIGHT_SLEEP_T);
+  wifi_fpm_open();
+  gpio_pin_wakeup_enable(GPIO_ID_PIN(wakePin),GPIO_PIN_INTR_LOLEVEL);
+  wifi_fpm_set_wakeup_cb(sleepEnded);
+  wifi_fpm_do_sleep(ms*1000);
+  // The CPU only goes to sleep once it idles in delay()
+  while(!timerWoke&&digitalRead(wakePin)==HIGH&&millis()-began<=ms){
+    delay(1);
+  }
+  gpio_pin_wakeup_disable();
+  wifi_fpm_close();
+
+  // The calibration is the length of an RTC tick in microseconds, times 4096
+  uint32_t slept   = (uint64_t)(system_get_rtc_time()-rtcStart)*system_rtc_clock_cali_proc()/4096000;
+  uint32_t counted = millis()-began;
+  if(slept>counted){
+    missedMs += slept-counted;
+  }
+  sleepMs += max(slept,counted);
+  sleeps++;
+  if(wakeHook){
+    wakeHook();
+  }
+}
+
+void powerIdle(uint32_t ms){
+  if(canLightSleep(ms)){
+    lightSleep(ms);
+    return;
+  }
+  uint32_t began = millis();
+  if(mode==POWER_FULL){
+    delay(ms);
+  }else{
+    // Short steps so a press doesn't wait for the end of a long idle
+    while(!wakeRequested()&&millis()-began<ms){
+      delay(min<uint32_t>(powerIdleStep,ms-(millis()-began)));
+    }
+  }
+  idleMs += millis()-began;
+}
+
+void powerSetBacklight(uint8_t percent){
+  backlight = min<uint8_t>(percent,100);
+  writeBacklight();
+}
+
+void powerDisplaySleep(RenderContext &ctx, bool sleep){
+  if(sleep==displayAsleep){
+    return;
+  }
+  if(sleep){
+    displayAsleep   = true;
+    displayOffSince = powerMillis();
+    writeBacklight();
+    ctx.tft.sendCommand(ILI9341_DISPOFF);
+    ctx.tft.sendCommand(ILI9341_SLPIN);
+  }else{
+    ctx.tft.sendCommand(ILI9341_SLPOUT);
+    workDelay("display wake",displayWakeTime);
+    ctx.tft.sendCommand(ILI9341_DISPON);
+    displayAsleep = false;
+    displayOffMs += powerMillis()-displayOffSince;
+    writeBacklight();
+  }
+  Serial.println(sleep ? F("Display asleep") : F("Display awake"));
+}
+
+bool powerDisplayAsleep(){
+  return displayAsleep;
+}
+
+void powerDisplayIdle(RenderContext &ctx, bool idle){
+  ctx.tft.sendCommand(idle ? idleModeOn : idleModeOff);
+}
+
+// Share of total in tenths of a percent
+static uint32_t permille(uint32_t part, uint32_t total){
+  return (uint64_t)part*1000/total;
+}
+
+// Average of a current drawn for part of the time
+static uint32_t averageUa(uint32_t ua, uint32_t part, uint32_t total){
+  return (uint64_t)ua*part/total;
+}
+
+void powerReport(Print &out){
+  uint32_t now   = powerMillis();
+  uint32_t total = max<uint32_t>(now-statsStart,1);
+  uint32_t asleep = min(sleepMs,total);
+  uint32_t idle   = min(idleMs,total-asleep);
+  uint32_t busy   = total-asleep-idle;
+  uint32_t displayOff = displayOffMs+(displayAsleep ? now-displayOffSince : 0);
+  uint32_t displayOn  = total-min(displayOff,total);
+
+  uint32_t cpu    = averageUa(cpuAwakeUa,total-asleep,total)+averageUa(cpuLightSleepUa,asleep,total);
+  uint32_t wifi   = wifiOn ? wifiAverageUa : 0;
+  uint32_t panel  = averageUa(displayOnUa,displayOn,total)+averageUa(displaySleepUa,total-displayOn,total);
+  uint32_t level  = backlightPin>=0 ? backlight : 100;
+  uint32_t light  = averageUa(backlightFullUa*level/100,displayOn,total);
+  uint32_t supply = cpu+wifi+panel+light+boardUa;
+
+  out.printf("Power: %s, busy %lu.%lu%%, idle %lu.%lu%%, light sleep %lu.%lu%% (%lu sleeps) over %lu s\n",
+             mode==POWER_SAVE ? "save" : "full",
+             (unsigned long)(permille(busy,total)/10), (unsigned long)(permille(busy,total)%10),
+             (unsigned long)(permille(idle,total)/10), (unsigned long)(permille(idle,total)%10),
+             (unsigned long)(permille(asleep,total)/10), (unsigned long)(permille(asleep,total)%10),
+             (unsigned long)sleeps, (unsigned long)(total/1000));
+  out.printf("Power: about %lu mA, CPU %lu, Wi-Fi %lu, display %lu, backlight %lu (%lu%%), board %lu\n",
+             (unsigned long)(supply/1000), (unsigned long)(cpu/1000), (unsigned long)(wifi/1000),
+             (unsigned long)(panel/1000), (unsigned long)(light/1000), (unsigned long)level,
+             (unsigned long)(boardUa/1000));
+}
+
+void powerReset(){
+  statsStart      = powerMillis();
+  idleMs          = 0;
+  sleepMs         = 0;
+  sleeps          = 0;
+  displayOffMs    = 0;
+  displayOffSince = statsStart;
+}
@@ -0,0 +1,116 @@
+#include "Scheduler.h"
+#include "WorkSlice.h"
+
+Scheduler::Scheduler() : taskCount(0), idleCap(maxIdle), idleHook(NULL), clock(NULL) {}
+
+int8_t Scheduler::add(const char *name, TaskCallback callback, uint32_t period, bool enabled){
+  if(taskCount>=maxTasks){
+    return -1;
+  }
+  Task &task    = tasks[taskCount];
+  task.name     = name;
+  task.callback = callback;
+  task.period   = period;
+  task.deadline = now();
+  task.enabled  = enabled;
+  task.lateRuns = 0;
+  return taskCount++;
+}
+
+void Scheduler::enable(int8_t id, bool enabled){
+  if(id<0||id>=taskCount){
+    return;
+  }
+  if(enabled&&!tasks[id].enabled){
+    tasks[id].deadline = now(); // A task that gets switched on runs right away
+  }
+  tasks[id].enabled = enabled;
+}
+
+bool Scheduler::isEnabled(int8_t id) const{
+  return id>=0&&id<taskCount&&tasks[id].enabled;
+}
+
+void Scheduler::runIn(int8_t id, uint32_t ms){
+  if(id>=0&&id<taskCount){
+    tasks[id].deadline = now()+ms;
+  }
+}
+
+void Scheduler::setPeriod(int8_t id, uint32_t period){
+  if(id>=0&&id<taskCount){
+    tasks[id].period = period;
+  }
+}
+
+void Scheduler::run(){
+
+  // Keep running whichever ready task is the most overdue until none are left
+  while(true){
+    uint32_t current = now();
+    int8_t ready = -1;
+    int32_t mostLate = -1;
+    for(uint8_t i=0;i<taskCount;i++){
+      int32_t late = (int32_t)(current-tasks[i].deadline); // Wraps safely past day 49
+      if(tasks[i].enabled&&late>=0&&late>mostLate){
+        ready = i;
+        mostLate = late;
+      }
+    }
+    if(ready<0){
+      break;
+    }
+
+    Task &task = tasks[ready];
+    if((uint32_t)mostLate>task.period){
+      task.lateRuns++;
+    }
+    // Schedule the next run before the call so the task can override it
+    task.deadline += task.period;
+    if((int32_t)(current-task.deadline)>0){
+      task.deadline = current+task.period; // Fell behind, don't try to catch up
+    }
+    task.callback();
+    workYield(task.name); // Whatever the task didn't slice itself counts against it
+  }
+
+  uint32_t idle = idleTime();
+  if(idle>0&&idleHook){
+    workPause("idle");
+    idleHook(idle);
+    workResume();
+  }else if(idle>0){
+    workDelay("idle",idle);
+  }
+}
+
+uint32_t Scheduler::idleTime() const{
+  uint32_t current = now();
+  uint32_t idle = idleCap;
+  for(uint8_t i=0;i<taskCount;i++){
+    if(!tasks[i].enabled){
+      continue;
+    }
+    int32_t wait = (int32_t)(tasks[i].deadline-current);
+    if(wait<=0){
+      return 0;
+    }
+    if((uint32_t)wait<idle){
+      idle = wait;
+    }
+  }
+  return idle;
+}
+
+void Scheduler::setIdleHook(IdleHook hook, ClockSource source){
+  idleHook = hook;
+  clock    = source;
+}
+
+void Scheduler::printStats(Print &out) const{
+  for(uint8_t i=0;i<taskCount;i++){
+    out.printf("Task %s: every %lu ms, %u late runs%s\n", tasks[i].name,
+               (unsigned long)tasks[i].period, tasks[i].lateRuns,
+               tasks[i].enabled ? "" : " (off)");
+  }
+}
@@ -0,0 +1,180 @@
+#include "Slideshow.h"
+#include "BmpStream.h"
+#include "JpegStream.h"
+#include "Colors.h"
+#include "Power.h"
+
+static BmpPrefetch prefetch;       // Next picture, decoded while the current one is displayed
+static ImageIndex *slides = NULL;  // Pictures being shown
+static ImageFile   image;          // Picture being read ahead, the index keeps it open
+static uint16_t    position = 0;   // Position of that picture in the index
+static uint32_t    cadence  = slideshowRefreshTime;
+static Transition  transition = slideshowTransition;
+static uint32_t    dueAt    = 0;   // When that picture should be complete on screen, on the powerMillis() clock
+
+// How long the picture at position stays up before the next one is due
+static uint32_t holdTime(){
+  uint32_t ms = slides->showTime(position);
+  return ms ? ms : cadence;
+}
+
+// How a slow picture could draw faster. Only BMPs get .565 copies, JPEGs
+// decode in proportion to their pixels, so only a smaller file helps them.
+static const char *speedHint(const ImageIndexEntry &entry){
+  if(entry.format==FORMAT_JPEG){
+    return ", save it at the screen size or as a BMP";
+  }
+  return entry.cacheIndex==ImageIndex::noCache ? ", convert it to .565" : "";
+}
+
+// Keeps the draw time of the picture just shown and flags it when it takes
+// too much of the cadence, with a hint on how to speed it up
+static void recordDrawTime(uint32_t ms){
+  const ImageIndexEntry &entry = slides->entry(position);
+  bool slow = ms*100>holdTime()*slideshowDrawShare;
+  if(slow&&!entry.slow){
+    Serial.printf("Picture %u takes %lu ms to draw, too slow for the cadence%s\n", position, (unsigned long)ms,
+                  speedHint(entry));
+  }
+  uint32_t now = powerMillis();
+  if(entry.drawTime&&(int32_t)(now-dueAt)>0){ // Only once there was an estimate to start from
+    Serial.printf("Picture %u on screen %lu ms after its deadline\n", position, (unsigned long)(now-dueAt));
+  }
+  slides->setDrawTime(position,min<uint32_t>(ms,0xFFFF));
+  slides->flagSlow(position,slow);
+}
+
+// Opens the picture at position, BMPs start being read ahead. JPEGs are
+// decoded straight to the display, their decoder can't work ahead of time.
+static void openPicture(RenderContext &ctx){
+  image = slides->open(position);
+  if(image.isOpen()&&slides->entry(position).format==FORMAT_BMP){
+    prefetch.start(ctx,image);
+  }
+}
+
+// Opens the picture the slideshow is at, unless it already is open
+static void load(RenderContext &ctx, ImageIndex &index){
+  if(slides==&index){
+    return;
+  }
+  prefetch.begin(prefetchBufferSize);
+  slides = &index;
+  if(position>=index.count()){
+    position = 0;
+  }
+  openPicture(ctx);
+}
+
+void slideshowEnter(RenderContext &ctx, ImageIndex &index){
+  load(ctx,index);
+  dueAt = powerMillis(); // The first picture goes up right away
+}
+
+bool slideshowWarm(RenderContext &ctx, ImageIndex &index){
+  load(ctx,index);
+  return slideshowPrefetchStep();
+}
+
+bool slideshowStep(RenderContext &ctx){
+  if(!slides||slides->count()==0){
+    return true;
+  }
+
+  // Pictures are opened by their directory position, files that aren't
+  // images were already left out when the index was built.
+  // The change between pictures is mostly a push of already decoded pixels.
+  uint32_t drawStart = millis();
+  ImageReturnCode stat;
+  if(slides->entry(position).format==FORMAT_JPEG){
+    uint32_t start = millis();
+    stat = drawJpegCentered(ctx,image,BLACK);
+    ctx.reader.printStatus(stat);
+    if(stat==IMAGE_SUCCESS&&!bmpAbortRequested()){
+      Serial.printf("JPEG draw %lu ms, %lu bytes read\n",
+                    (unsigned long)(millis()-start), (unsigned long)jpegBytesRead());
+    }
+  }else{
+    uint32_t start = millis();
+    stat = drawTransition(ctx,prefetch,transition,BLACK);
+    ctx.reader.printStatus(stat);
+    if(stat==IMAGE_SUCCESS&&!bmpAbortRequested()&&transition==TRANSITION_NONE){
+      Serial.printf("Swap %lu ms (%u rows prefetched), full draw %lu ms, %lu of %lu bytes read\n",
+                    (unsigned long)prefetch.swapTime, prefetch.prefetchedRows,
+                    (unsigned long)prefetch.drawTime, (unsigned long)prefetch.bytesRead, (unsigned long)image.fileSize());
+    }else if(stat==IMAGE_SUCCESS&&!bmpAbortRequested()){
+      Serial.printf("Transition %lu ms (%u rows prefetched), %lu of %lu bytes read\n",
+                    (unsigned long)(millis()-start), prefetch.prefetchedRows,
+                    (unsigned long)prefetch.bytesRead, (unsigned long)image.fileSize());
+    }
+  }
+
+  if(stat==IMAGE_SUCCESS&&!bmpAbortRequested()){
+    recordDrawTime(millis()-drawStart);
+  }
+
+  // Deadlines move by the whole time the picture is held, so a late picture
+  // doesn't delay the next one. After a long stall the cadence starts over instead of rushing.
+  uint32_t hold = holdTime();
+  dueAt += hold;
+  if((int32_t)(powerMillis()-dueAt)>0){
+    dueAt = powerMillis()+hold;
+  }
+
+  // Back to the first picture after the last one
+  position = slides->next(position);
+  openPicture(ctx);
+  return stat==IMAGE_SUCCESS;
+}
+
+uint32_t slideshowTimeToNext(){
+  if(!slides||slides->count()==0){
+    return cadence;
+  }
+  uint32_t lead = slides->entry(position).drawTime+slideshowDrawMargin;
+  int32_t wait = (int32_t)(dueAt-lead-powerMillis());
+  return wait>0 ? wait : 0;
+}
+
+void slideshowSetCadence(uint32_t ms){
+  cadence = ms;
+}
+
+void slideshowSetTransition(Transition next){
+  transition = next;
+}
+
+void slideshowReport(Print &out){
+  if(!slides){
+    return;
+  }
+  uint16_t slowCount = 0;
+  for(uint16_t i=0;i<slides->count();i++){
+    const ImageIndexEntry &entry = slides->entry(i);
+    if(entry.slow){
+      out.printf("Picture %u: %ux%u, %u ms to draw%s\n", i, entry.width, entry.height, entry.drawTime,
+                 speedHint(entry));
+      slowCount++;
+    }
+  }
+  out.printf("%u of %u pictures are too slow for a %lu ms cadence\n",
+             slowCount, slides->count(), (unsigned long)cadence);
+}
+
+bool slideshowPrefetchStep(){
+  return prefetch.step(prefetchRowsPerStep);
+}
+
+void slideshowExit(){
+  // Nothing to stop, the JPEG decoder is kept so coming back doesn't
+  // allocate it again
+}
+
+void slideshowRelease(){
+  if(slides){
+    slides->close();
+  }
+  image = ImageFile();
+  prefetch.end();
+  slides = NULL;
+}
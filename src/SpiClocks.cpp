@@ -0,0 +1,134 @@
+#include "SpiClocks.h"
+
+// Clocks to try in MHz, fastest first. The ESP8266 divides its 80 MHz
+// clock, anything else is rounded to the nearest divider.
+static const uint8_t sdClocks[]  = {80, 40, 27, 20, 16, 10, 4};
+static const uint8_t tftClocks[] = {80, 40, 27, 20, 16, 10};
+static const uint8_t sdClockCount  = sizeof(sdClocks);
+static const uint8_t tftClockCount = sizeof(tftClocks);
+
+static const uint8_t tftDefaultMHz = 40; // Kept when the display can't be read back
+static const uint8_t tftReadMHz    = 4;  // ILI9341 register reads are only specified to about 6.6 MHz
+
+static const uint8_t calibrationPasses  = 4; // Reads of the checked sectors that must all match
+
+// Stretches of the card checked at each clock: the partition sectors,
+// the start of the FAT and the start of the data area (root directory
+// and the first pictures). Real content, so that data dependent errors
+// of a marginal clock show, not just a run of mostly zero sectors.
+static const uint8_t checkRegions = 3;
+static const uint8_t regionSectors[checkRegions] = {8, 8, 48};
+static uint32_t regionStart[checkRegions];
+
+static uint8_t sdCsPin;
+static uint8_t sdClockIndex = sdClockCount-1;
+
+static uint32_t crc32(uint32_t crc, const uint8_t *data, size_t length){
+  crc = ~crc;
+  while(length--){
+    crc ^= *data++;
+    for(uint8_t bit=0;bit<8;bit++){
+      crc = (crc>>1)^(0xEDB88320&(0-(crc&1)));
+    }
+  }
+  return ~crc;
+}
+
+static bool sdBeginAt(SdFat &sd, uint8_t clockMHz){
+  sd.end();
+  return sd.begin(SdSpiConfig(sdCsPin, SHARED_SPI, SD_SCK_MHZ(clockMHz)));
+}
+
+// CRC of the checked sectors, read raw so it doesn't depend on open files
+static bool sectorChecksum(SdFat &sd, uint32_t &crc){
+  uint8_t sector[512];
+  crc = 0;
+  for(uint8_t region=0;region<checkRegions;region++){
+    for(uint8_t i=0;i<regionSectors[region];i++){
+      if(!sd.card()->readSector(regionStart[region]+i,sector)){
+        return false;
+      }
+      crc = crc32(crc,sector,sizeof(sector));
+    }
+  }
+  return true;
+}
+
+uint8_t calibrateSdClock(SdFat &sd, uint8_t csPin){
+
+  sdCsPin = csPin;
+  uint32_t reference;
+  sdClockIndex = sdClockCount-1;
+  if(!sdBeginAt(sd,sdClocks[sdClockIndex])){
+    return 0; // No card
+  }
+  regionStart[0] = 0;
+  regionStart[1] = sd.fatStartSector();
+  regionStart[2] = sd.dataStartSector();
+  if(!sectorChecksum(sd,reference)){
+    return 0; // The card can't even be read slowly
+  }
+
+  for(uint8_t i=0;i<sdClockCount-1;i++){
+    bool stable = sdBeginAt(sd,sdClocks[i]);
+    for(uint8_t pass=0;stable&&pass<calibrationPasses;pass++){
+      uint32_t crc;
+      stable = sectorChecksum(sd,crc)&&crc==reference;
+    }
+    if(stable){
+      sdClockIndex = i;
+      Serial.printf("SD clock %u MHz\n",sdClocks[i]);
+      return sdClocks[i];
+    }
+  }
+
+  // Only the reference clock works
+  sdBeginAt(sd,sdClocks[sdClockIndex]);
+  Serial.printf("SD clock %u MHz\n",sdClocks[sdClockIndex]);
+  return sdClocks[sdClockIndex];
+}
+
+bool sdClockFallback(SdFat &sd){
+  if(sdClockIndex+1>=sdClockCount){
+    return false;
+  }
+  sdClockIndex++;
+  Serial.printf("SD read error, dropping the SD clock to %u MHz\n",sdClocks[sdClockIndex]);
+  return sdBeginAt(sd,sdClocks[sdClockIndex]);
+}
+
+// Writes a few memory access control values at the clock being tried and
+// reads them back at the slow read clock, so a mismatch means the write failed
+static bool tftReadsBack(Adafruit_ILI9341 &tft, uint8_t writeMHz){
+  static const uint8_t patterns[] = {0x48, 0x28, 0x88, 0xE8};
+  bool stable = true;
+  for(uint8_t i=0;i<sizeof(patterns)&&stable;i++){
+    uint8_t value = patterns[i];
+    tft.setSPISpeed((uint32_t)writeMHz*1000000);
+    tft.sendCommand(ILI9341_MADCTL,&value,1);
+    tft.setSPISpeed((uint32_t)tftReadMHz*1000000);
+    stable = tft.readcommand8(ILI9341_RDMADCTL)==value;
+  }
+  return stable;
+}
+
+uint8_t calibrateTftClock(Adafruit_ILI9341 &tft){
+  tft.begin((uint32_t)tftDefaultMHz*1000000); // Reset and init once, the clock is changed in place
+
+  uint8_t clockMHz = tftDefaultMHz;
+  if(!tftReadsBack(tft,tftReadMHz)){
+    // MISO isn't wired or the panel doesn't answer, nothing to check against
+    Serial.printf("TFT readback unavailable, using %u MHz\n",clockMHz);
+  }else{
+    for(uint8_t i=0;i<tftClockCount;i++){
+      clockMHz = tftClocks[i];
+      if(tftReadsBack(tft,clockMHz)){
+        break;
+      }
+    }
+    Serial.printf("TFT clock %u MHz\n",clockMHz);
+  }
+  tft.setRotation(tft.getRotation()); // Put the real value back
+  tft.setSPISpeed((uint32_t)clockMHz*1000000);
+  return clockMHz;
+}
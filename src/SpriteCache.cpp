@@ -0,0 +1,157 @@
+#include "SpriteCache.h"
+#include "ImageArena.h"
+
+// Name of a sprite file, without the directory or extension
+static void spriteName(const char *filename, char *name){
+  const char *start = strrchr(filename,'/');
+  start = start ? start+1 : filename;
+  const char *dot = strrchr(start,'.');
+  size_t length = dot ? (size_t)(dot-start) : strlen(start);
+  length = min<size_t>(length,atlasNameLength-1);
+  memcpy(name,start,length);
+  name[length] = 0;
+}
+
+static uint16_t readLE16(ImageFile &file){
+  uint8_t b[2] = {0,0};
+  file.read(b,2);
+  return b[0] | (b[1]<<8);
+}
+
+SpriteCache::SpriteCache() : count(0) {}
+
+SpriteCache::~SpriteCache(){
+  clear();
+}
+
+int8_t SpriteCache::load(RenderContext &ctx, const char *filename){
+
+  if(count>=maxSprites){
+    Serial.println(F("Sprite cache full"));
+    return -1;
+  }
+
+  // Let the image reader do the BMP decoding into a 16 bit canvas,
+  // then keep our own copy of the pixels since the image frees its
+  // canvas when it goes out of scope
+  Adafruit_Image img;
+  ImageReturnCode stat = ctx.reader.loadBMP(filename, img);
+  ctx.reader.printStatus(stat);
+  if(stat!=IMAGE_SUCCESS){
+    return -1;
+  }
+  if(img.getFormat()!=IMAGE_16){
+    Serial.println(F("Sprite is not a color image"));
+    return -1;
+  }
+
+  GFXcanvas16 *canvas = (GFXcanvas16 *)img.getCanvas();
+  uint32_t pixelCount = (uint32_t)img.width()*img.height();
+  uint16_t *pixels = arenaTake<uint16_t>(POOL_SPRITES,pixelCount);
+  if(!pixels){
+    Serial.println(F("No room for the sprite in the arena, left out"));
+    return -1;
+  }
+  memcpy(pixels, canvas->getBuffer(), pixelCount*sizeof(uint16_t));
+
+  Sprite &sprite = sprites[count];
+  sprite.pixels = pixels;
+  sprite.width  = img.width();
+  sprite.height = img.height();
+  spriteName(filename,names[count]);
+  return count++;
+}
+
+uint8_t SpriteCache::loadAtlas(RenderContext &ctx, const char *filename){
+  File32 file = ctx.sd.open(filename);
+  if(!file){
+    return 0;
+  }
+  uint8_t loaded = loadAtlas(file);
+  file.close();
+  return loaded;
+}
+
+uint8_t SpriteCache::loadAtlas(ImageFile file){
+
+  if(count>0){
+    Serial.println(F("Atlas must be loaded into an empty sprite cache"));
+    return 0;
+  }
+  uint8_t header[atlasHeaderSize];
+  if(file.read(header,atlasHeaderSize)!=atlasHeaderSize||
+     (header[0]|(header[1]<<8)|((uint32_t)header[2]<<16)|((uint32_t)header[3]<<24))!=atlasMagic){
+    Serial.println(F("Not a sprite atlas"));
+    return 0;
+  }
+  uint16_t stored  = header[4]|(header[5]<<8);
+  uint16_t entries = stored;
+  if(entries>maxSprites){
+    Serial.println(F("Atlas has more sprites than the cache holds"));
+    entries = maxSprites;
+  }
+
+  uint32_t pixelCount = 0;
+  for(uint8_t i=0;i<entries;i++){
+    file.read(names[i],atlasNameLength);
+    names[i][atlasNameLength-1] = 0;
+    sprites[i].width  = readLE16(file);
+    sprites[i].height = readLE16(file);
+    pixelCount += (uint32_t)sprites[i].width*sprites[i].height;
+  }
+
+  // Pixels of every sprite in one go, they follow the whole table
+  uint32_t dataStart = atlasHeaderSize+(uint32_t)stored*atlasEntrySize;
+  uint16_t *atlasPixels = arenaTake<uint16_t>(POOL_SPRITES,pixelCount);
+  if(!atlasPixels){
+    Serial.println(F("No room for the sprite atlas in the arena"));
+    return 0;
+  }
+  if(!file.seekSet(dataStart)||
+     file.read(atlasPixels,pixelCount*sizeof(uint16_t))!=(int)(pixelCount*sizeof(uint16_t))){
+    Serial.println(F("Sprite atlas is truncated"));
+    arenaRelease(POOL_SPRITES); // The cache is empty, nothing else is in there
+    return 0;
+  }
+
+  uint16_t *pixels = atlasPixels;
+  for(uint8_t i=0;i<entries;i++){
+    sprites[i].pixels = pixels;
+    pixels += (uint32_t)sprites[i].width*sprites[i].height;
+  }
+  count = entries;
+  return count;
+}
+
+int8_t SpriteCache::find(const char *filename) const{
+  char name[atlasNameLength];
+  spriteName(filename,name);
+  for(uint8_t i=0;i<count;i++){
+    if(strcmp(names[i],name)==0){
+      return i;
+    }
+  }
+  return -1;
+}
+
+void SpriteCache::draw(RenderContext &ctx, int8_t id, int16_t x, int16_t y) const{
+  const Sprite *sprite = get(id);
+  if(sprite){
+    ctx.tft.drawRGBBitmap(x, y, sprite->pixels, sprite->width, sprite->height);
+  }
+}
+
+const Sprite *SpriteCache::get(int8_t id) const{
+  if(id<0||id>=count){
+    return NULL;
+  }
+  return &sprites[id];
+}
+
+void SpriteCache::clear(){
+  for(uint8_t i=0;i<count;i++){
+    sprites[i].pixels = NULL;
+  }
+  arenaRelease(POOL_SPRITES);
+  count = 0;
+}
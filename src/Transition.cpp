@@ -0,0 +1,49 @@
+#include "Transition.h"
+#include "WorkSlice.h"
+
+ImageReturnCode drawTransition(RenderContext &ctx, BmpPrefetch &next, Transition transition, uint16_t background){
+
+  if(transition==TRANSITION_NONE){
+    return next.draw(ctx);
+  }
+  bool scroll = transition!=TRANSITION_WIPE&&ctx.tft.getRotation()%2==0&&ctx.length==ILI9341_TFTHEIGHT;
+  // Rotation 2 writes the screen's rows to the frame memory bottom up and
+  // the scroll runs along the panel, so both the rows and the direction
+  // are mirrored there
+  bool flipped = ctx.tft.getRotation()==2;
+  bool panelUp = (transition==TRANSITION_PUSH_UP)!=flipped;
+  if(scroll){
+    ctx.tft.setScrollMargins(0,0); // The whole screen scrolls
+  }
+
+  ImageReturnCode stat = IMAGE_SUCCESS;
+  uint32_t nextStep = millis();
+  for(uint16_t done=0;done<ctx.length&&stat==IMAGE_SUCCESS;done+=transitionBandRows){
+    if(bmpAbortRequested()){
+      break; // Leaves the screen half changed, the next mode draws over it
+    }
+    uint16_t rows = min<uint16_t>(transitionBandRows,ctx.length-done);
+    // A push down comes in from the top, so its bottom rows go first
+    int16_t y = transition==TRANSITION_PUSH_DOWN ? ctx.length-done-rows : done;
+    if(scroll){
+      int32_t wait = nextStep-millis();
+      if(wait>0){
+        workDelay("transition",wait);
+      }
+      nextStep = millis()+transitionStepTime;
+    }
+    stat = next.drawRows(ctx,y,rows,background);
+    if(scroll){
+      // The band overwrote the one leaving the screen, scroll right away so
+      // it is on screen as short as possible. Scrolling the panel up the new
+      // rows show at its bottom, scrolling it down at its top.
+      uint16_t memoryRow = flipped ? ctx.length-y-rows : y;
+      ctx.tft.scrollTo(panelUp ? (memoryRow+rows)%ctx.length : memoryRow);
+    }
+  }
+  if(scroll){
+    ctx.tft.scrollTo(0); // Only changes anything after an abort
+  }
+  next.finish();
+  return stat;
+}
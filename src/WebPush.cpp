@@ -0,0 +1,505 @@
+#include "WebPush.h"
+#include "BmpStream.h"
+#include "Colors.h"
+#include "WorkSlice.h"
+#include "ImageArena.h"
+#include "ImageCache.h"
+#include <ESP8266WiFi.h>
+#include <ESP8266WebServer.h>
+
+static const uint8_t  headerMax      = 66;   // BMP headers up to the 16 bit masks
+static const uint16_t rowBufferBytes = 2048; // Widest file row that can be pushed
+static const uint8_t  pathLengthMax  = 64;
+static const char    *pushTempName   = "push.tmp"; // Saved uploads are written here, renamed once they check out
+
+// Where a push is in the file
+enum PushStage : uint8_t {
+  STAGE_HEADER, // Collecting the header
+  STAGE_SKIP,   // Past the header, before the pixels
+  STAGE_PIXELS,
+  STAGE_DONE,   // Every row is on screen, the rest of the upload is ignored
+  STAGE_FAILED  // Not a picture that can be pushed
+};
+
+static ESP8266WebServer server(80);
+static RenderContext *pushCtx = NULL;
+static const char    *saveDirectory = "/";
+static PushStartHook  startHook = NULL;
+static PushDoneHook   doneHook  = NULL;
+static bool           announced = false; // The address was printed
+
+static uint8_t   head[headerMax];
+static uint8_t   headLength, headNeeded;
+static uint16_t *rowBuffer = NULL; // One file row, taken from the arena's rows pool for a push
+static uint16_t *pixelRow  = NULL; // One screen row, the same
+static uint32_t  rowFill;    // Bytes of the current file row so far
+static uint32_t  fileRow;    // Rows completed
+static uint32_t  fileOffset; // Bytes of the file consumed
+static uint32_t  pixelsLeft; // Direct pushes
+static uint8_t   carry;      // First byte of a pixel split between two chunks
+static bool      carrying;
+static bool      direct;     // Whole .565 file, pixels go straight from the socket buffer
+static bool      started;    // The start hook ran
+static PushStage stage;
+static BmpHeader header;
+static BmpLayout layout;
+static File32    saveFile;   // Temporary copy of the upload
+static bool      saving;
+static char      savePath[pathLengthMax]; // Where the copy goes once the picture is on screen
+static char      tempPath[pathLengthMax];
+static char      copyPath[pathLengthMax]; // The .565 copy a saved .bmp would have
+static const char *saveProblem; // Why a save that was asked for didn't happen, NULL when it did
+static int       saveStatus;    // HTTP status for it
+static int       failStatus;
+static bool      aborted;    // The client went away before the end
+static uint32_t  startedAt;
+static const char *failure; // Why the last push was refused, NULL when it wasn't
+static PushReport report;
+
+static uint16_t headLE16(uint8_t at){
+  return head[at] | (head[at+1]<<8);
+}
+
+static uint32_t headLE32(uint8_t at){
+  return head[at] | (head[at+1]<<8) | ((uint32_t)head[at+2]<<16) | ((uint32_t)head[at+3]<<24);
+}
+
+static void fail(const char *why, int status = 415){
+  failure = why;
+  failStatus = status;
+  stage = STAGE_FAILED;
+  if(saving){
+    saveFile.remove(); // Only pictures that can be shown are kept
+    saving = false;
+  }
+}
+
+// Clears the screen around the picture and gets the display ready for
+// the first row. The mode on screen stops drawing first.
+static void startPixels(){
+  RenderContext &ctx = *pushCtx;
+  if(!clipBmp(header,(ctx.width-header.width)/2,(ctx.length-header.height)/2,0,0,ctx.width,ctx.length,layout)){
+    fail("Nothing of the picture fits on the screen");
+    return;
+  }
+  direct = header.raw565&&layout.width==header.width&&layout.height==header.height;
+  if(!direct&&header.rowSize>rowBufferBytes){
+    fail("Picture too wide to push");
+    return;
+  }
+  if(!rowBuffer){
+    rowBuffer = arenaTake<uint16_t>(POOL_ROWS,rowBufferBytes/2);
+    pixelRow  = rowBuffer ? arenaTake<uint16_t>(POOL_ROWS,ILI9341_TFTHEIGHT) : NULL;
+  }
+  if(!pixelRow){
+    fail("No room in the arena for the rows",503);
+    return;
+  }
+  if(startHook){
+    startHook();
+  }
+  started = true;
+  if(layout.width<ctx.width||layout.height<ctx.length){
+    ctx.tft.fillScreen(BLACK);
+  }
+  if(direct){
+    // One address window for the whole picture, the pixels just follow each other
+    ctx.tft.startWrite();
+    ctx.tft.setAddrWindow(layout.x,layout.y,layout.width,layout.height);
+    ctx.tft.endWrite();
+    pixelsLeft = (uint32_t)header.width*header.height;
+  }
+  stage = header.pixelOffset>fileOffset ? STAGE_SKIP : STAGE_PIXELS;
+}
+
+// Parses the header once enough of it is in, returns false while more is needed
+static bool parseHeader(){
+  if(headLength<headNeeded){
+    return false;
+  }
+  if(headLE32(0)==raw565Magic){
+    header.width       = headLE16(4);
+    header.height      = headLE16(6);
+    header.pixelOffset = raw565HeaderSize;
+    header.rowSize     = header.width*2;
+    header.depth       = 16;
+    header.bottomUp    = false;
+    header.rgb555      = false;
+    header.raw565      = true;
+  }else if(headLE16(0)==0x4D42){
+    if(headNeeded<54){
+      headNeeded = 54; // Up to the end of the info header
+      return false;
+    }
+    uint32_t compression = headLE32(30);
+    if(compression==3&&headNeeded<66){
+      headNeeded = 66; // And the color masks
+      return false;
+    }
+    header.pixelOffset = headLE32(10);
+    header.width       = (int32_t)headLE32(18);
+    header.height      = (int32_t)headLE32(22);
+    header.depth       = headLE16(28);
+    header.bottomUp    = header.height>0;
+    header.height      = header.bottomUp ? header.height : -header.height;
+    header.rowSize     = ((uint32_t)header.width*header.depth+31)/32*4;
+    header.rgb555      = header.depth==16&&(compression==0||headLE32(54)==0x7C00);
+    header.raw565      = false;
+    if(!((header.depth==24&&compression==0)||(header.depth==16&&(compression==0||compression==3)))){
+      fail("Only uncompressed 16 and 24 bit BMPs and .565 files can be pushed");
+      return true;
+    }
+    if(header.pixelOffset<headLength){
+      fail("Broken BMP header");
+      return true;
+    }
+  }else{
+    fail("Not a BMP or .565 file");
+    return true;
+  }
+  if(header.width<=0||header.height<=0){
+    fail("Empty picture");
+    return true;
+  }
+  startPixels();
+  return true;
+}
+
+// Pushes pixels of a .565 file that fits the screen, straight from the
+// buffer unless a chunk boundary left them unaligned
+static uint32_t pushDirect(uint8_t *data, uint32_t length){
+  RenderContext &ctx = *pushCtx;
+  uint32_t used = 0;
+  ctx.tft.startWrite();
+  if(carrying&&length){
+    uint8_t pair[2] = {carry, data[0]};
+    memcpy(pixelRow,pair,2);
+    ctx.tft.writePixels(pixelRow,1,true,true);
+    carrying = false;
+    pixelsLeft--;
+    used = 1;
+  }
+  while(pixelsLeft&&length-used>=2){
+    uint32_t count = min<uint32_t>((length-used)/2,pixelsLeft);
+    uint8_t *src = &data[used];
+    if(((uintptr_t)src&1)==0){
+      ctx.tft.writePixels((uint16_t *)src,count,true,true);
+    }else{
+      count = min<uint32_t>(count,ILI9341_TFTHEIGHT);
+      memcpy(pixelRow,src,count*2);
+      ctx.tft.writePixels(pixelRow,count,true,true);
+    }
+    used += count*2;
+    pixelsLeft -= count;
+  }
+  ctx.tft.endWrite();
+  if(pixelsLeft&&length-used==1){
+    carry = data[used++];
+    carrying = true;
+  }
+  if(!pixelsLeft){
+    stage = STAGE_DONE;
+  }
+  return used;
+}
+
+// Writes the file row just completed to its place on the screen
+static void drawRow(){
+  RenderContext &ctx = *pushCtx;
+  uint32_t imageRow = header.bottomUp ? header.height-1-fileRow : fileRow;
+  if(imageRow<layout.firstRow||imageRow>=(uint32_t)layout.firstRow+layout.height){
+    return; // Cropped away
+  }
+  uint8_t *src = (uint8_t *)rowBuffer+layout.spanStart;
+  uint16_t *pixels = pixelRow;
+  if(header.raw565){
+    pixels = (uint16_t *)src; // Already what the display takes, the span starts on an even byte
+  }else{
+    convertBmpRow(header,src,0,layout.width,pixelRow);
+  }
+  ctx.tft.startWrite();
+  ctx.tft.setAddrWindow(layout.x,layout.y+imageRow-layout.firstRow,layout.width,1);
+  ctx.tft.writePixels(pixels,layout.width,true,header.raw565);
+  ctx.tft.endWrite();
+}
+
+static uint32_t pushRows(uint8_t *data, uint32_t length){
+  uint32_t used = 0;
+  while(used<length&&fileRow<(uint32_t)header.height){
+    uint32_t take = min<uint32_t>(length-used,header.rowSize-rowFill);
+    memcpy((uint8_t *)rowBuffer+rowFill,&data[used],take);
+    rowFill += take;
+    used += take;
+    if(rowFill==header.rowSize){
+      drawRow();
+      rowFill = 0;
+      fileRow++;
+    }
+  }
+  if(fileRow>=(uint32_t)header.height){
+    stage = STAGE_DONE;
+  }
+  return used;
+}
+
+// Takes the next chunk of the upload
+static void feed(uint8_t *data, uint32_t length){
+  if(saving&&saveFile.write(data,length)!=length){
+    Serial.println(F("Card full or gone, the pushed picture isn't saved"));
+    saveFile.remove();
+    saving = false;
+    saveProblem = "Card full or gone";
+    saveStatus = 507;
+  }
+  while(length&&stage!=STAGE_DONE&&stage!=STAGE_FAILED){
+    uint32_t used;
+    switch(stage){
+    case STAGE_HEADER:
+      used = min<uint32_t>(length,headNeeded-headLength);
+      memcpy(&head[headLength],data,used);
+      headLength += used;
+      fileOffset += used;
+      parseHeader(); // May ask for more of the header
+      break;
+    case STAGE_SKIP:
+      used = min<uint32_t>(length,header.pixelOffset-fileOffset);
+      fileOffset += used;
+      if(fileOffset>=header.pixelOffset){
+        stage = STAGE_PIXELS;
+      }
+      break;
+    default:
+      used = direct ? pushDirect(data,length) : pushRows(data,length);
+      fileOffset += used;
+      break;
+    }
+    data += used;
+    length -= used;
+  }
+  if(stage==STAGE_DONE&&!report.displayMs){
+    report.displayMs = millis()-startedAt;
+    report.shown = true;
+  }
+}
+
+// A file of the save directory, false when the path doesn't fit
+static bool savePathFor(const char *name, char *path){
+  size_t dirLength = strlen(saveDirectory);
+  if(dirLength+strlen(name)+2>pathLengthMax){
+    return false;
+  }
+  sprintf(path,"%s%s%s",saveDirectory,dirLength&&saveDirectory[dirLength-1]=='/' ? "" : "/",name);
+  return true;
+}
+
+// Why a name the client sent can't be saved, NULL when it can. Only plain
+// .bmp and .565 names are taken, which keeps config.txt and the other
+// files on the card out of reach, and a picture that is already there is
+// only replaced with overwrite=1.
+static const char *checkSaveName(const char *name){
+  saveStatus = 400;
+  if(*name=='.'||strchr(name,'/')||strchr(name,'\\')||
+     !(hasExtension(name,".bmp")||hasExtension(name,".565"))){
+    return "Only plain .bmp and .565 file names can be saved";
+  }
+  if(!savePathFor(name,savePath)||!savePathFor(pushTempName,tempPath)){
+    return "File name too long to save";
+  }
+  bool overwrite = server.hasArg("overwrite");
+  if(pushCtx->sd.exists(savePath)&&!overwrite){
+    saveStatus = 409;
+    return "A file with that name is already there, push with overwrite=1 to replace it";
+  }
+  // A .bmp and a .565 of the same name are a picture and its cached copy
+  strcpy(copyPath,savePath);
+  bool isBmp = hasExtension(name,".bmp");
+  if(!swapExtension(copyPath,pathLengthMax,isBmp ? ".565" : ".bmp")){
+    return "File name too long to save";
+  }
+  if(!isBmp&&pushCtx->sd.exists(copyPath)){
+    saveStatus = 409;
+    return "A .bmp of that name is there, its .565 copy is made from it";
+  }
+  if(isBmp&&pushCtx->sd.exists(copyPath)&&!overwrite){
+    saveStatus = 409;
+    return "A .565 of that name is already there, push with overwrite=1 to replace it";
+  }
+  if(!isBmp){
+    copyPath[0] = 0;
+  }
+  return NULL;
+}
+
+// Starts the temporary copy on the card. Nothing of the card is touched
+// under the real name until the whole picture was shown.
+static void openSaveFile(const char *filename){
+  saveProblem = checkSaveName(filename);
+  if(!saveProblem){
+    saveFile = pushCtx->sd.open(tempPath,O_WRONLY|O_CREAT|O_TRUNC);
+    saving = saveFile;
+    if(!saving){
+      saveProblem = "Can't write to the card";
+      saveStatus = 507;
+    }
+  }
+  if(saveProblem){
+    Serial.printf("Push: not saved, %s\n",saveProblem);
+  }
+}
+
+// Gives the temporary copy its real name
+static void commitSaveFile(){
+  saveFile.close();
+  SdFat &sd = pushCtx->sd;
+  if(sd.exists(savePath)){
+    sd.remove(savePath); // Only there with overwrite=1, checked when the upload started
+  }
+  if(copyPath[0]&&sd.exists(copyPath)){
+    sd.remove(copyPath); // The copy of the old picture, made again at the next boot
+  }
+  if(!sd.rename(tempPath,savePath)){
+    sd.remove(tempPath);
+    saving = false;
+    saveProblem = "Can't rename the saved copy";
+    saveStatus = 500;
+  }
+}
+
+static void finishPush(bool endedEarly){
+  aborted = endedEarly;
+  if(!aborted&&stage==STAGE_PIXELS&&!direct&&rowFill){
+    drawRow(); // The last row of a BMP may be missing its padding
+    report.displayMs = millis()-startedAt;
+    report.shown = true;
+  }
+  if(!aborted&&!report.shown&&!failure){
+    fail("The upload ended before the whole picture",400);
+  }
+  if(saving&&(aborted||!report.shown)){
+    saveFile.remove(); // Only pictures that were shown in full are kept
+    saving = false;
+  }
+  if(saving){
+    commitSaveFile();
+  }
+  report.saved = saving;
+  saving = false;
+  report.uploadMs = millis()-startedAt;
+  Serial.printf("Push: %lu bytes in %lu ms (%lu KB/s), %s%s\n",
+                (unsigned long)report.bytes, (unsigned long)report.uploadMs,
+                (unsigned long)(report.uploadMs ? report.bytes/report.uploadMs : 0),
+                report.shown ? "shown" : aborted ? "aborted" : failure ? failure : "not shown",
+                report.saved ? ", saved" : "");
+  if(report.shown){
+    Serial.printf("Push: on screen %lu ms after the first byte\n",(unsigned long)report.displayMs);
+  }
+  if(started&&doneHook){
+    doneHook(report);
+  }
+  started = false;
+  if(rowBuffer){
+    arenaRelease(POOL_ROWS);
+    rowBuffer = pixelRow = NULL;
+  }
+}
+
+static void handleUpload(){
+  HTTPUpload &upload = server.upload();
+  switch(upload.status){
+  case UPLOAD_FILE_START:
+    memset(&report,0,sizeof(report));
+    stage = STAGE_HEADER;
+    headLength = 0;
+    headNeeded = raw565HeaderSize;
+    rowFill = fileRow = fileOffset = 0;
+    carrying = direct = started = false;
+    failure = NULL;
+    failStatus = 0;
+    saveProblem = NULL;
+    aborted = false;
+    startedAt = millis();
+    saving = false;
+    if(server.hasArg("save")){
+      openSaveFile(upload.filename.c_str());
+    }
+    break;
+  case UPLOAD_FILE_WRITE:
+    report.bytes += upload.currentSize;
+    feed(upload.buf,upload.currentSize);
+    workYield("web push"); // Lets the Wi-Fi stack take the next packets in
+    break;
+  case UPLOAD_FILE_END:
+    finishPush(false);
+    break;
+  case UPLOAD_FILE_ABORTED:
+    finishPush(true);
+    break;
+  }
+}
+
+static void handlePushDone(){
+  char reply[128];
+  if(aborted){
+    server.send(400,"text/plain","The upload was aborted\n");
+    return;
+  }
+  if(failure){
+    sprintf(reply,"%s\n",failure);
+    server.send(failStatus,"text/plain",reply);
+    return;
+  }
+  if(saveProblem){
+    snprintf(reply,sizeof(reply),"Shown but not saved: %s\n",saveProblem);
+    server.send(saveStatus,"text/plain",reply);
+    return;
+  }
+  sprintf(reply,"%lu bytes in %lu ms, on screen after %lu ms%s\n",
+          (unsigned long)report.bytes, (unsigned long)report.uploadMs,
+          (unsigned long)report.displayMs, report.saved ? ", saved" : "");
+  server.send(200,"text/plain",reply);
+}
+
+static const char pushForm[] PROGMEM =
+  "<html><body><form method='post' enctype='multipart/form-data'>"
+  "<input type='file' name='image' accept='.bmp,.565'> "
+  "<button formaction='/push'>Show</button> "
+  "<button formaction='/push?save=1'>Show and save</button> "
+  "<button formaction='/push?save=1&overwrite=1'>Show and replace</button>"
+  "</form></body></html>";
+
+static void handleForm(){
+  server.send_P(200,"text/html",pushForm);
+}
+
+bool webPushBegin(RenderContext &ctx, const char *ssid, const char *password, const char *saveDir,
+                  PushStartHook onStart, PushDoneHook onDone){
+  if(!ssid||*ssid=='\0'){
+    return false;
+  }
+  pushCtx = &ctx;
+  saveDirectory = saveDir;
+  startHook = onStart;
+  doneHook = onDone;
+  WiFi.mode(WIFI_STA);
+  WiFi.begin(ssid,password);
+  server.on("/",HTTP_GET,handleForm);
+  server.on("/push",HTTP_POST,handlePushDone,handleUpload);
+  server.begin();
+  Serial.printf("Joining Wi-Fi network %s\n",ssid);
+  return true;
+}
+
+void webPushPoll(){
+  if(!pushCtx){
+    return;
+  }
+  if(!announced&&WiFi.status()==WL_CONNECTED){
+    Serial.printf("Wi-Fi connected, push pictures to http://%s/\n",WiFi.localIP().toString().c_str());
+    announced = true;
+  }
+  server.handleClient();
+}
+
+const PushReport &webPushLast(){
+  return report;
+}
@@ -0,0 +1,97 @@
+#include "WorkSlice.h"
+
+struct WorkSite {
+  const char *name;
+  uint32_t    longest; // Microseconds
+  uint32_t    yields;
+  uint16_t    late;    // Gaps of workGapWarning or more
+};
+
+static WorkSite sites[workSiteMax];
+static uint8_t  siteCount  = 0;
+static uint8_t  longestAt  = 0;
+static uint32_t sliceStart = 0; // micros() the current slice started at
+
+static WorkSite &findSite(const char *name){
+  // The same literal can be at a different address in every file
+  for(uint8_t i=0;i<siteCount;i++){
+    if(sites[i].name==name||strcmp(sites[i].name,name)==0){
+      return sites[i];
+    }
+  }
+  if(siteCount<workSiteMax){
+    WorkSite &site = sites[siteCount++];
+    site.name    = name;
+    site.longest = 0;
+    site.yields  = 0;
+    site.late    = 0;
+    return site;
+  }
+  return sites[workSiteMax-1];
+}
+
+static void closeSlice(const char *name){
+  uint32_t gap = micros()-sliceStart;
+  WorkSite &site = findSite(name);
+  site.yields++;
+  if(gap>=workGapWarning){
+    site.late++;
+  }
+  if(gap>site.longest){
+    site.longest = gap;
+    if(gap>sites[longestAt].longest){
+      longestAt = &site-sites;
+    }
+  }
+}
+
+void workCheckpoint(const char *site){
+  if(micros()-sliceStart>=workSliceBudget){
+    workYield(site);
+  }
+}
+
+void workYield(const char *site){
+  closeSlice(site);
+  yield();
+  sliceStart = micros(); // Time spent in yield() isn't ours
+}
+
+void workDelay(const char *site, uint32_t ms){
+  workPause(site);
+  delay(ms);
+  workResume();
+}
+
+void workPause(const char *site){
+  closeSlice(site);
+}
+
+void workResume(){
+  sliceStart = micros();
+}
+
+uint32_t workLongestGap(){
+  return siteCount ? sites[longestAt].longest : 0;
+}
+
+const char *workLongestSite(){
+  return siteCount ? sites[longestAt].name : "none";
+}
+
+void workReport(Print &out){
+  out.printf("Work slices of %lu us, longest gap %lu us in %s\n", (unsigned long)workSliceBudget,
+             (unsigned long)workLongestGap(), workLongestSite());
+  for(uint8_t i=0;i<siteCount;i++){
+    const WorkSite &site = sites[i];
+    out.printf("  %-12s longest %7lu us, %lu yields, %u over %lu ms\n", site.name,
+               (unsigned long)site.longest, (unsigned long)site.yields, site.late,
+               (unsigned long)(workGapWarning/1000));
+  }
+}
+
+void workReset(){
+  siteCount  = 0;
+  longestAt  = 0;
+  sliceStart = micros();
+}
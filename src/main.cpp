@@ -23,255 +23,433 @@
 // CS (SD card) -> D3
 // SD card SPI uses the same pins (Hardware SPI)
 
+// The benchmark suite in test/ builds the rest of src/ with its own setup() and loop()
+#ifndef PIO_UNIT_TESTING
+
 #include <Adafruit_GFX.h>         // Core graphics library
 #include <Adafruit_ILI9341.h>     // Hardware-specific library
 #include <SdFat.h>                // SD card & FAT filesystem library
 #include <Adafruit_SPIFlash.h>    // SPI / QSPI flash library
 #include <Adafruit_ImageReader.h> // Image-reading functions
+#include "Pins.h"                 // SD card, display and button pins
+#include "RenderContext.h"        // References to the display, reader and SD
+#include "Colors.h"               // Names for common 16-bit colors
+#include "BmpStream.h"            // Single open BMP streaming to the display
+#include "ImageCache.h"           // Raw .565 copies of the slideshow pictures
+#include "ImageIndex.h"           // List of the slideshow pictures built at boot
+#include "Scheduler.h"            // Cooperative task scheduler
+#include "Slideshow.h"            // Image display mode
+#include "PatternMode.h"          // Heart animation and message mode
+#include "Button.h"               // Debounced mode change button
+#include "SpiClocks.h"            // SD and TFT SPI clock calibration
+#include "Instrument.h"           // Cycle count probes around the hot paths
+#include "FlashAssets.h"          // Copies of the assets in the flash file system
+#include "Config.h"               // Settings file on the SD card
+#include "ModeManager.h"          // Mode registry, keeps the next mode loaded
+#include "WebPush.h"              // Pictures pushed over Wi-Fi
+#include "WorkSlice.h"            // Bounded work slices between yields
+#include "ImageArena.h"           // Static RAM for the image buffers
+#include "Power.h"                // Sleeping between deadlines on a battery
 
 
-// TFT display and SD card share the hardware SPI interface, using
-// 'select' pins for each to identify the active device on the bus.
-
-#define SD_CS   D3 // SD card select pin
-#define TFT_CS D8 // TFT select pin
-#define TFT_DC  D2 // TFT display/command pin
-
-// Assign human-readable names to some common 16-bit color values:
-#define	BLACK   0x0000
-#define	BLUE    0x001F
-#define	RED     0xF800
-#define	GREEN   0x07E0
-#define CYAN    0x07FF
-#define MAGENTA 0xF81F
-#define YELLOW  0xFFE0
-#define WHITE   0xFFFF
-
 SdFat                SD;         // SD card filesystem
 Adafruit_ImageReader reader(SD); // Image-reader object, pass in SD filesys
 Adafruit_ILI9341     tft    = Adafruit_ILI9341(TFT_CS, TFT_DC);
-String rootDir = "/";
 const uint16_t screenWidth = 240,
               screenLength = 320;
-const int slideshowRefreshTime = 4000; // The time it takes to change between two pictures, in milliseconds
-volatile bool changeButtonState = false;
-const uint8_t maxStates = 2;
-uint8_t currentState = 0;
-uint32_t prevStateChange = millis(); // Millis timer for setting refresh, used as a button debouncer
-
-// Helper function to display a single image to the TFT display
-// given a full file path from the root directory
-void displayImageTFT(Adafruit_ILI9341 tft, String filename){
-
-  ImageReturnCode stat; // Status from image-reading functions
-  int32_t            width  = 0, // BMP image dimensions
-                     height = 0;
-  stat = reader.bmpDimensions(filename.c_str(), &width, &height);
-  reader.printStatus(stat);  
-  stat = reader.drawBMP(filename.c_str(), tft, (screenWidth-width)/2, (screenLength-height)/2);
-  reader.printStatus(stat);   
+const uint32_t heapReportInterval = 60000; // How often the heap state is printed, in milliseconds
+const uint32_t buttonPollTime = 10; // How often the mode change button is checked, in milliseconds
+const uint32_t prefetchStepTime = 1; // Time between two prefetch steps, leaves room for the other tasks
+const uint32_t serialPollTime = 100; // How often serial commands are checked, in milliseconds
+const uint32_t startupStepTime = 1; // Time between two startup stages, lets the button and serial tasks run
+const uint32_t warmStepTime = 5; // Time between two warm-up steps of the next mode
+const uint32_t webPollTime = 5; // How often the web server takes new clients, in milliseconds
+const uint32_t powerCheckTime = 1000; // How often the display sleep timeout is checked, in milliseconds
+const size_t modeWarmBudget = 20480; // Arena bytes the mode that isn't shown may keep
+uint8_t startMode = 0; // Mode shown once the startup is done
+RenderContext ctx = {tft, reader, SD, screenWidth, screenLength}; // Passed by reference to every draw function
+DeviceConfig config; // Settings from the SD card, read once at boot over the built in defaults
+ImageIndex slideshowIndex; // Valid pictures of the slideshow directory, scanned once at boot
+Scheduler scheduler; // Runs the modes, button handling and diagnostics as tasks
+ModeManager modes(scheduler,modeWarmBudget); // The modes the button cycles through
+int8_t slideshowTaskId, prefetchTaskId, patternTaskId, startupTaskId, warmTaskId, webTaskId; // Scheduler ids of the mode tasks
+int8_t buttonTaskId, powerTaskId;
+bool pushHolding = false; // A pushed picture is on screen, the mode comes back after a cadence
+bool pushSaved = false; // A pushed picture was saved, the index is rebuilt before the slideshow uses it again
+uint32_t pushShownAt = 0;
+uint32_t lastActivity = 0; // powerMillis() of the last press or push, for the display sleep
+
+// What is left to do after the splash is on screen, one stage per run of the startup task
+enum BootStage : uint8_t {
+  BOOT_SD_MOUNT,
+  BOOT_CONFIG,
+  BOOT_CONVERT,
+  BOOT_FLASH_SYNC,
+  BOOT_INDEX,
+  BOOT_DONE
+};
+BootStage bootStage = BOOT_SD_MOUNT;
+bool sdMounted = false;
+uint32_t bootPhaseStart = 0;
+
+// Diagnostics task, prints the free heap and how fragmented it is
+// along with the scheduler's task stats every heapReportInterval
+void reportHeap(){
+  Serial.printf("Heap: %lu bytes free, largest block %lu bytes, %u%% fragmented\n",
+                (unsigned long)ESP.getFreeHeap(), (unsigned long)ESP.getMaxFreeBlockSize(),
+                ESP.getHeapFragmentation());
+  Serial.printf("Longest time without yielding: %lu us in %s\n",
+                (unsigned long)workLongestGap(), workLongestSite());
+  powerReport(Serial);
+  scheduler.printStats(Serial);
 }
-// Overload to display the bitmap image at a different location
-void displayImageTFT(Adafruit_ILI9341 tft, String filename, int x, int y){
 
-  ImageReturnCode stat; // Status from image-reading functions
-  stat = reader.drawBMP(filename.c_str(), tft, x, y);
-  reader.printStatus(stat);   
+// Serial command task, reports are only printed when asked for so
+// they never cost frame time:
+//   i  prints the probe summaries and starts them over
+//   h  prints the heap and scheduler stats
+//   s  lists the slideshow pictures too slow for the cadence
+//   c  prints the settings in use
+//   m  prints which modes are loaded
+//   w  prints the longest gaps between yields and starts them over
+//   a  prints what the image buffer pools hold
+//   p  prints the duty cycle and estimated current and starts them over
+void serialTask(){
+  while(Serial.available()){
+    switch(Serial.read()){
+    case 'i':
+      instrumentDump(Serial);
+      instrumentReset();
+      break;
+    case 'h':
+      reportHeap();
+      break;
+    case 's':
+      slideshowReport(Serial);
+      break;
+    case 'c':
+      printConfig(Serial,config);
+      break;
+    case 'm':
+      modes.printStats(Serial);
+      break;
+    case 'w':
+      workReport(Serial);
+      workReset();
+      break;
+    case 'a':
+      arenaReport(Serial);
+      break;
+    case 'p':
+      powerReport(Serial);
+      powerReset();
+      break;
+    default:
+      break;
+    }
+  }
 }
 
-// Queries all the images in a directory and display them to the tft screen object
-// Supports a maximum filename length of 50 characters
-void displayAllImagesDir(Adafruit_ILI9341 tft,String rootDir, volatile bool changeStateButton){
+// Prints how long the boot phase that just ended took
+void bootPhase(const char *name){
+  uint32_t now = millis();
+  Serial.printf("Boot %s: %lu ms, %lu ms since reset\n", name,
+                (unsigned long)(now-bootPhaseStart), (unsigned long)now);
+  bootPhaseStart = now;
+  workYield(name); // Setup runs outside the scheduler, give the system a turn between phases
+}
 
-  const uint8_t nameLengthMax = 50; 
-  char name[nameLengthMax];
-  String completeFilename = rootDir;
+// Hands the settings read from the card to the modes
+void applyConfig(){
+  slideshowSetCadence(config.slideshowTime);
+  slideshowSetTransition(config.transition);
+  setBmpDownscale(config.downscale);
+  if(config.specCount){
+    patternSetContent(config.specs,config.specCount);
+  }
+  scheduler.setPeriod(patternTaskId,config.patternFrameTime);
+  startMode = config.startMode;
+}
 
-  File32 dir = SD.open(rootDir); // Open the root directory of SD card
-  File32 entry = dir.openNextFile(); // Open the first file in the SD card
-  uint32_t time_1 = millis(); // Might cause an overflow close to day 50....
+// Shows the first slide kept in flash while the rest of the device starts up
+void paintSplash(){
+  char path[24];
+  sprintf(path,flashSlidePath,0);
+  fs::File splash = flashOpen(path);
+  if(splash){
+    drawBmpCentered(ctx,splash);
+    splash.close();
+  }
+}
+
+// Picks up pictures saved by a push, whatever ended the hold
+void refreshPushedIndex(){
+  if(pushSaved&&bootStage==BOOT_DONE){
+    slideshowRelease(); // Closes the picture it had open
+    slideshowIndex.build(ctx,config.rootDir,&config.playlist);
+    pushSaved = false;
+  }
+}
 
-  //Display the first image in the SD card
-  entry.getName(name,nameLengthMax);
-  completeFilename.concat(name);
-  displayImageTFT(tft,completeFilename);
+// The slideshow hooks need the index
+void slideshowModeEnter(RenderContext &ctx){
+  refreshPushedIndex();
+  slideshowEnter(ctx,slideshowIndex);
+}
+bool slideshowModeWarm(RenderContext &ctx){
+  refreshPushedIndex();
+  return slideshowWarm(ctx,slideshowIndex);
+}
 
-  // If there any more files display them with the set delay
-  entry = dir.openNextFile();
-  while(entry){
+// The modes in the order the button goes through them, mode 0 is the default
+const ModeHooks modeTable[] = {
+  // name         enter               exit            warm               release           pool           warm bytes
+  {"slideshow",   slideshowModeEnter, slideshowExit,  slideshowModeWarm, slideshowRelease, POOL_PREFETCH, prefetchBufferSize},
+  {"pattern",     patternEnter,       patternExit,    patternWarm,       patternRelease,   POOL_SPRITES,  patternWarmBytes},
+};
 
-    // Exit upon encountering the mode change button
-    if(changeButtonState){
-      return;
+// Button task, switches to the next mode once per queued press
+void buttonTask(){
+
+  if(bootStage!=BOOT_DONE){
+    return; // Presses wait in the queue until there is a mode to change
+  }
+  uint32_t pressedAt, firstPress = 0;
+  uint8_t presses = 0;
+  while(buttonPopPress(pressedAt)){
+    if(presses==0){
+      firstPress = pressedAt;
     }
+    presses++;
+  }
+  if(presses==0){
+    return;
+  }
 
-    if(millis()-time_1>=slideshowRefreshTime){
-      entry.getName(name,nameLengthMax);
-      completeFilename=rootDir;
-      completeFilename.concat(name);
-      displayImageTFT(tft,completeFilename);
-
-      entry = dir.openNextFile();
-      time_1 = millis();
-    }  
-    yield();
-  } 
-
-  // Delay for the last picture :)
-  while(!(millis()-time_1>=slideshowRefreshTime)){
-    yield();
+  renderAbort = false; // Every waiting press is handled
+  if(buttonPending()){
+    renderAbort = true; // Unless another one came in meanwhile
+  }
+  lastActivity = powerMillis();
+  if(powerDisplayAsleep()){
+    // The press only wakes the display, the mode comes back where it was
+    powerDisplaySleep(ctx,false);
+    modes.enter(ctx,modes.current());
+    return;
   }
+  Serial.printf("State Change after %lu ms (%u presses, %u dropped)\n",
+                (unsigned long)(millis()-firstPress), presses, buttonDroppedPresses());
+  modes.advance(ctx,presses); // Loops back to the first mode after the last one
+}
 
+// Slideshow task, runs once per picture
+void slideshowTask(){
+  if(!slideshowStep(ctx)&&!slideshowIndex.onFlash()&&SD.card()->errorCode()&&sdClockFallback(SD)){
+    // The card was remounted slower, which closed every file
+    slideshowRelease();
+    slideshowIndex.build(ctx,config.rootDir,&config.playlist);
+    slideshowEnter(ctx,slideshowIndex);
+  }
+  scheduler.enable(prefetchTaskId); // Start reading the next picture
+  scheduler.runIn(slideshowTaskId,slideshowTimeToNext()); // Early enough for the next one to be on time
 }
 
-// ISR handler for the mode change button, only sets a boolean value
-IRAM_ATTR void modeChangeInterupt(){
- changeButtonState = true; 
+// Reads the next slideshow picture during the delay, stops itself once done
+void prefetchTask(){
+  if(slideshowPrefetchStep()){
+    scheduler.disable(prefetchTaskId);
+  }
 }
 
-// A mode for the heart animation and the personal message :)
-void patternMode(Adafruit_ILI9341 tft){
-  
-  tft.fillScreen(BLACK); // Sets the background
-  displayImageTFT(tft,"/pattern/bottom-message.bmp",-5,220); // Manual offset due to the text not being quite centered...
-
-  // Locations to store the positions of each animated sprite
-  const uint16_t spriteSize = 32; // assumes square sprites, used for max border calculation
-  const uint16_t maxSprites = 10; // Don't make this too big or collisions will grind the animation to a halt...
-  const uint16 xBorderSprite = screenWidth-spriteSize;
-  const uint16 yBorderSprite = screenLength-spriteSize-100; // 100 is the hight of the message sprite
-  uint16_t posXArr[maxSprites]={0}; // Arrays to store the position of all the sprites in the animation
-  uint16_t posYArr[maxSprites]={0};
-  bool onScreen[maxSprites]={false}; // Array to store the state of each sprite
-  const int refreshTime = 500; // Do the animation activity at the millisecond rate specified ("refresh it")
-  uint32_t time1 = millis(); // timer variable for millis timer
-  
-  // Loop for the heart animations :)
-  // Done by loading a sprite at a location where one isn't loaded
-  // If one is loaded, load a "blank" sprite the same color as the background
-  while(true){
-    
-    yield();
-    // Exit upon encountering the mode change button
-    if(changeButtonState){
-      return;
-    }
+// Pattern mode task, one animation step
+void patternTask(){
+  patternStep(ctx);
+}
 
-    if(millis()-time1>=refreshTime){
-
-    //Pick a random sprite and see if it is loaded, if so clear it
-    uint16_t spritePick = random(maxSprites);
-
-    if(onScreen[spritePick]){
-      // clear the sprite if it was already on the screen
-      displayImageTFT(tft,"/pattern/clear-32.bmp",posXArr[spritePick],posYArr[spritePick]);
-      onScreen[spritePick] = false;
-    }else{
-      // if the sprite was not loaded, pick a new location and load it in the screen
-      uint16_t xPos = random(xBorderSprite);
-      uint16_t yPos = random(yBorderSprite);
-
-      // Detect sprite collision and re-roll position if detected
-      bool collision  = false;
-      do{
-        collision=false;
-        if(changeButtonState){
-          return;
-        }
-        for(int i=0;i<maxSprites;i++){
-          if(onScreen[i]){
-            // Detect collision in the X plane
-            if ( !(xPos<(posXArr[i]-spriteSize-1) || xPos>(posXArr[i]+spriteSize+1)) ){
-              // Collision in the x direction detected, lets check the y direction
-              if( !(yPos<(posYArr[i]-spriteSize-1) || yPos>(posYArr[i]+spriteSize+1)) ){
-                Serial.println("Y Collision detected!");
-                collision = true;
-                // Roll cordinates again
-                xPos = random(xBorderSprite);
-                yPos=random(yBorderSprite);
-                continue;
-              }
-            }
-          }
-        }
-      }while(collision);
-
-      posXArr[spritePick] = xPos;
-      posYArr[spritePick] = yPos;
-      onScreen[spritePick] = true;
-      // Display the image once the proper cordinates have been loaded 
-      displayImageTFT(tft,"/pattern/heart.bmp",xPos,yPos);
-    
-    }
+// A picture is being pushed over Wi-Fi, the mode on screen stops drawing
+void pushStarted(){
+  modes.suspend();
+  powerDisplaySleep(ctx,false);
+  pushHolding = false;
+}
 
-      time1 = millis();// refresh the time variable
+// Keeps the pushed picture up for one slideshow cadence
+void pushDone(const PushReport &report){
+  pushHolding = true;
+  pushShownAt = millis();
+  lastActivity = powerMillis();
+  pushSaved |= report.saved;
+}
+
+// Web task, serves the push uploads and brings the mode back after one
+void webTask(){
+  webPushPoll();
+  if(pushHolding&&millis()-pushShownAt>=config.slideshowTime){
+    pushHolding = false;
+    if(bootStage!=BOOT_DONE||!modes.suspended()){
+      return; // The startup or a button press already put a mode on screen
     }
+    modes.enter(ctx,modes.current()); // The slideshow rebuilds its index first if a picture was saved
+  }
+}
 
+// Power task, puts the display to sleep once nobody used the device for a while.
+// The mode stops with it, a press brings both back.
+void powerTask(){
+  if(bootStage!=BOOT_DONE||modes.suspended()||powerDisplayAsleep()){
+    return; // Still starting, or a pushed picture is up
   }
+  if(powerMillis()-lastActivity>=config.sleepMinutes*60000UL){
+    modes.suspend();
+    powerDisplaySleep(ctx,true);
+  }
+}
 
+// Scheduler idle hook, a press that comes in while waiting gets handled right away
+void idleWait(uint32_t ms){
+  powerIdle(ms);
+  if(renderAbort){
+    scheduler.runIn(buttonTaskId,0);
+  }
+}
+
+// Puts the device in the power mode of the settings, once it is known
+// whether Wi-Fi is used
+void startPower(bool wifiUsed){
+  powerBegin(config.powerMode,wifiUsed,BUTTON_PIN,buttonResume);
+  powerSetBacklight(config.backlight);
+  if(config.powerMode==POWER_SAVE){
+    scheduler.setMaxIdle(powerMaxIdle);
+    scheduler.setPeriod(buttonTaskId,powerMaxIdle); // idleWait() runs it as soon as there is a press
+  }
+  if(config.sleepMinutes){
+    scheduler.enable(powerTaskId);
+  }
+}
+
+// Loads the mode after the current one a little at a time, stops itself once done
+void warmTask(){
+  if(!modes.warmStep(ctx)){
+    scheduler.disable(warmTaskId);
+  }
 }
 
 // Splash screen for when there is no SD card in the device
-void errorMode(Adafruit_ILI9341 tft,String message){
-  tft.fillScreen(BLACK);
-  tft.setCursor(0,0);
-  tft.setTextSize(2);
-  tft.setTextColor(WHITE);
-  tft.println(message);
-  tft.println(" ");
-  tft.println("Please unplug and \nreplug the device");
+void errorMode(RenderContext &ctx,const char *message){
+  ctx.tft.fillScreen(BLACK);
+  ctx.tft.setCursor(0,0);
+  ctx.tft.setTextSize(2);
+  ctx.tft.setTextColor(WHITE);
+  ctx.tft.println(message);
+  ctx.tft.println(" ");
+  ctx.tft.println("Please unplug and \nreplug the device");
+  powerDisplayIdle(ctx,true); // Held until a reset, white on black needs no more than 8 colors
+}
+
+// Startup task, mounts the card and builds the index behind the splash.
+// Each stage is one run so the scheduler gets to the other tasks in between,
+// the slowest ones only take long the first time (conversion and flash copies).
+void startupTask(){
+  switch(bootStage){
+  case BOOT_SD_MOUNT:
+    Serial.print(F("Initializing filesystem..."));
+    sdMounted = calibrateSdClock(SD, SD_CS); // Mounts at the fastest clock the wiring allows
+    Serial.println(sdMounted ? F("OK!") : F("SD begin() failed"));
+    bootPhase("sd mount");
+    bootStage = sdMounted ? BOOT_CONFIG : BOOT_INDEX;
+    break;
+  case BOOT_CONFIG:
+    if(!loadConfig(SD,configPath,config)){
+      Serial.printf("No %s, using the built in settings\n",configPath);
+    }
+    applyConfig();
+    printConfig(Serial,config);
+    if(webPushBegin(ctx,config.wifiSsid,config.wifiPassword,config.rootDir,pushStarted,pushDone)){
+      scheduler.enable(webTaskId);
+    }
+    startPower(scheduler.isEnabled(webTaskId));
+    bootPhase("config");
+    bootStage = BOOT_CONVERT;
+    break;
+  case BOOT_CONVERT:
+    if(config.convertTo565){
+      convertImagesTo565(ctx,config.rootDir);
+    }
+    bootPhase("565 conversion");
+    bootStage = BOOT_FLASH_SYNC;
+    break;
+  case BOOT_FLASH_SYNC:
+    if(config.copyToFlash){
+      flashSync(ctx,config.rootDir);
+    }
+    bootPhase("flash sync");
+    bootStage = BOOT_INDEX;
+    break;
+  case BOOT_INDEX:
+  default:
+    scheduler.disable(startupTaskId);
+    if(sdMounted){
+      slideshowIndex.build(ctx,config.rootDir,&config.playlist);
+      pushSaved = false; // Anything pushed so far is in it
+    }else if(slideshowIndex.buildFromFlash()==0){
+      // Without a card the slideshow plays what was copied to flash,
+      // unless there is nothing there either
+      errorMode(ctx,"SD card not detected");
+      return;
+    }
+    bootPhase("index");
+    bootStage = BOOT_DONE;
+    modes.enter(ctx,startMode);
+    lastActivity = powerMillis();
+    arenaReport(Serial); // How the first mode split the image buffers
+    break;
+  }
 }
 
 void setup(void) {
 
-  Serial.begin(9600);
-  tft.begin();          // Initialize screen
+  bootPhaseStart = millis();
+  Serial.begin(115200);
+  configDefaults(config); // Replaced by the card's settings once it is mounted
+  calibrateTftClock(tft); // Initialize screen at the fastest clock that reads back correctly
+  bootPhase("display");
+  // Something on screen first, the card and the index come after
+  if(flashBegin()){
+    paintSplash();
+  }
+  bootPhase("splash");
+
+  buttonBegin(BUTTON_PIN);
+  setBmpAbortFlag(&renderAbort); // Drawing stops early when the button is pressed
+  powerSetWakeFlag(&renderAbort); // So does waiting for the next deadline
+  scheduler.setIdleHook(idleWait,powerMillis); // Deadlines keep counting through light sleep
+
+  buttonTaskId    = scheduler.add("button",buttonTask,buttonPollTime);
+  slideshowTaskId = scheduler.add("slideshow",slideshowTask,slideshowRefreshTime,false);
+  prefetchTaskId  = scheduler.add("prefetch",prefetchTask,prefetchStepTime,false);
+  patternTaskId   = scheduler.add("pattern",patternTask,patternFrameTime,false);
+  scheduler.add("diagnostics",reportHeap,heapReportInterval);
+  scheduler.add("serial",serialTask,serialPollTime);
   // The Adafruit_ImageReader constructor call (above, before setup())
-  // accepts an uninitialized SdFat or FatVolume object. This MUST
-  // BE INITIALIZED before using any of the image reader functions!
-  Serial.print(F("Initializing filesystem..."));
-  if(!SD.begin(SD_CS, SD_SCK_MHZ(25))) { // ESP32 requires 25 MHz limit
-    Serial.println(F("SD begin() failed"));
-      errorMode(tft,"SD card not detected");
-    while(true){
-      yield();
-    }    
+  // accepts an uninitialized SdFat or FatVolume object. The startup task
+  // mounts it before any of the image reader functions get used.
+  startupTaskId = scheduler.add("startup",startupTask,startupStepTime);
+  warmTaskId = scheduler.add("warmup",warmTask,warmStepTime,false);
+  webTaskId  = scheduler.add("web",webTask,webPollTime,false);
+  powerTaskId = scheduler.add("power",powerTask,powerCheckTime,false);
+
+  for(const ModeHooks &hooks : modeTable){
+    modes.add(hooks);
   }
-
-  Serial.println(F("OK!"));
-
-  pinMode(D1,INPUT);
-  attachInterrupt(digitalPinToInterrupt(D1),modeChangeInterupt,FALLING);
+  modes.addTask(0,slideshowTaskId);
+  modes.addTask(0,prefetchTaskId);
+  modes.addTask(1,patternTaskId);
+  modes.setWarmTask(warmTaskId);
 
 }
 
 void loop() {
-  
-
-  if(changeButtonState&&(millis()-prevStateChange)>=50){ // check if button has been pressed, and debounce by 50 ms
-    Serial.println("State Change");
-    currentState++;
-    //loopback to first state (state 0) when max number of states is reached
-    if(currentState>=maxStates){
-      currentState=0;
-    }
-    changeButtonState=false;
-    prevStateChange=millis();
-  }else{
-    changeButtonState=false;
-  }
+  scheduler.run(); // Every mode runs as scheduler tasks
+}
 
-  // Switch between states
-  switch (currentState)
-  {
-  case 0:
-    displayAllImagesDir(tft,rootDir,changeButtonState);
-    break;
-  case 1:
-    patternMode(tft);
-    break;
-  default: // By default do state 0, though it should never get here
-    displayAllImagesDir(tft,rootDir,changeButtonState);
-    break;
-  }
-}
\ No newline at end of file
+#endif // PIO_UNIT_TESTING
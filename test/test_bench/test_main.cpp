@@ -0,0 +1,482 @@
+// On-device benchmarks, run with
+//   pio test -e nodemcu_bench
+// with an SD card in the device. The test pictures and files are written
+// to /bench/ on the card the first time, later runs reuse them. JPEGs
+// can't be made on the device, any .jpg copied to /bench/ is timed too.
+// Every measurement is printed as one line
+//   BENCH,<name>,<value>,<unit>
+// so the output can be grepped and compared between library versions.
+
+#include <Arduino.h>
+#include <unity.h>
+#include <Adafruit_GFX.h>
+#include <Adafruit_ILI9341.h>
+#include <SdFat.h>
+#include <Adafruit_ImageReader.h>
+#include "Pins.h"
+#include "RenderContext.h"
+#include "Colors.h"
+#include "BmpStream.h"
+#include "ImageCache.h"
+#include "JpegStream.h"
+#include "SpriteCache.h"
+#include "SpiClocks.h"
+#include "WorkSlice.h"
+
+SdFat                SD;
+Adafruit_ImageReader reader(SD);
+Adafruit_ILI9341     tft = Adafruit_ILI9341(TFT_CS, TFT_DC);
+RenderContext ctx = {tft, reader, SD, 240, 320};
+
+static const char *benchDir = "/bench/";
+static const char *scanDir  = "/bench/scan/";
+static const char *seqPath  = "/bench/seq.bin";
+
+static const uint8_t  frameRepeats  = 3;
+static const uint16_t scanFiles     = 64;
+static const uint32_t seqFileBytes  = 512UL*1024;
+static const uint16_t spriteBlits   = 200;
+static const uint8_t  fillRepeats   = 10;
+
+// Sizes and depths of the generated test pictures
+struct BenchImage {
+  uint16_t width, height;
+  uint16_t depth;
+};
+static const BenchImage benchImages[] = {
+  {64,64,24},  {120,160,24},  {240,320,24},
+  {64,64,16},  {120,160,16},  {240,320,16},
+  {64,64,8},   {120,160,8},   {240,320,8},
+};
+
+static uint8_t benchBlock[4096];
+static uint16_t rowPixels[2048];
+
+static void report(const char *name, uint32_t value, const char *unit){
+  Serial.printf("BENCH,%s,%lu,%s\n",name,(unsigned long)value,unit);
+}
+
+static void writeLE16(File32 &file, uint16_t v){
+  uint8_t b[2] = {(uint8_t)v,(uint8_t)(v>>8)};
+  file.write(b,2);
+}
+
+static void writeLE32(File32 &file, uint32_t v){
+  uint8_t b[4] = {(uint8_t)v,(uint8_t)(v>>8),(uint8_t)(v>>16),(uint8_t)(v>>24)};
+  file.write(b,4);
+}
+
+static void benchImagePath(char *path, const BenchImage &image, const char *ext){
+  sprintf(path,"%s%ux%u_%u%s",benchDir,image.width,image.height,image.depth,ext);
+}
+
+// Palette entry i of the generated palette pictures
+static void benchPaletteColor(uint16_t i, uint16_t colors, uint8_t bgra[4]){
+  uint8_t v = i*255/(colors-1);
+  bgra[0] = v;
+  bgra[1] = 255-v;
+  bgra[2] = v<<2;
+  bgra[3] = 0;
+}
+
+// Palette index of the pixel at column x of file row y in 1 and 4 bit
+// pictures, shifts every row so a row read from the wrong place shows
+static uint8_t benchPaletteIndex(uint16_t x, uint16_t y, uint16_t depth){
+  return (x+y*3)&((1<<depth)-1);
+}
+
+// Writes a bottom up BMP with a gradient, 16 bit pictures are RGB565 bit fields
+// and 1, 4 and 8 bit pictures use a full palette
+static bool writeBenchBmp(const char *path, const BenchImage &image){
+  uint32_t rowSize  = ((uint32_t)image.width*image.depth+31)/32*4;
+  uint16_t colors   = image.depth<=8 ? 1<<image.depth : 0;
+  uint32_t extra    = image.depth==16 ? 12 : colors*4;
+  uint32_t offset   = 54+extra;
+  File32 file = SD.open(path,O_WRONLY|O_CREAT|O_TRUNC);
+  if(!file){
+    return false;
+  }
+  writeLE16(file,0x4D42);
+  writeLE32(file,offset+rowSize*image.height);
+  writeLE32(file,0);
+  writeLE32(file,offset);
+  writeLE32(file,40);
+  writeLE32(file,image.width);
+  writeLE32(file,image.height);
+  writeLE16(file,1);
+  writeLE16(file,image.depth);
+  writeLE32(file,image.depth==16 ? 3 : 0);
+  writeLE32(file,rowSize*image.height);
+  writeLE32(file,2835);
+  writeLE32(file,2835);
+  writeLE32(file,colors);
+  writeLE32(file,0);
+  if(image.depth==16){
+    writeLE32(file,0xF800);
+    writeLE32(file,0x07E0);
+    writeLE32(file,0x001F);
+  }
+  for(uint16_t i=0;i<colors;i++){
+    uint8_t bgra[4];
+    benchPaletteColor(i,colors,bgra);
+    file.write(bgra,4);
+  }
+  for(uint16_t y=0;y<image.height;y++){
+    memset(benchBlock,0,rowSize);
+    for(uint16_t x=0;x<image.width;x++){
+      uint8_t r = x*255/image.width, g = y*255/image.height, b = (x+y)&0xFF;
+      if(image.depth==24){
+        benchBlock[x*3] = b;
+        benchBlock[x*3+1] = g;
+        benchBlock[x*3+2] = r;
+      }else if(image.depth==16){
+        uint16_t c = ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3);
+        benchBlock[x*2] = c;
+        benchBlock[x*2+1] = c>>8;
+      }else if(image.depth==8){
+        benchBlock[x] = r^g;
+      }else{
+        // Leftmost pixel in the top bits
+        uint32_t bit = (uint32_t)x*image.depth;
+        benchBlock[bit>>3] |= benchPaletteIndex(x,y,image.depth)<<(8-image.depth-(bit&7));
+      }
+    }
+    if(file.write(benchBlock,rowSize)!=rowSize){
+      file.close();
+      return false;
+    }
+  }
+  file.close();
+  return true;
+}
+
+// Reads every pixel row of an open picture into RAM without touching the display
+static bool decodeOnly(File32 &file){
+  BmpHeader header;
+  BmpLayout layout;
+  if(readBmpHeader(file,header)!=IMAGE_SUCCESS||!layoutBmp(ctx,header,0,0,layout)){
+    return false;
+  }
+  uint16_t maxRows = sizeof(rowPixels)/2/layout.width;
+  for(uint16_t row=0;row<layout.height;){
+    uint16_t rows = readBmpRows(file,header,layout,row,maxRows,rowPixels);
+    if(rows==0){
+      return false;
+    }
+    row += rows;
+  }
+  return true;
+}
+
+static void benchPicture(const char *path, const char *name, bool stock){
+  char label[48];
+  File32 file = SD.open(path);
+  TEST_ASSERT_TRUE_MESSAGE(file,path);
+
+  uint32_t start = millis();
+  for(uint8_t i=0;i<frameRepeats;i++){
+    TEST_ASSERT_TRUE(decodeOnly(file));
+  }
+  sprintf(label,"decode_%s",name);
+  report(label,(millis()-start)/frameRepeats,"ms");
+
+  start = millis();
+  for(uint8_t i=0;i<frameRepeats;i++){
+    TEST_ASSERT_EQUAL(IMAGE_SUCCESS,drawBmp(ctx,file,0,0));
+  }
+  sprintf(label,"draw_%s",name);
+  report(label,(millis()-start)/frameRepeats,"ms");
+  sprintf(label,"bytes_%s",name);
+  report(label,file.fileSize(),"B");
+  file.close();
+
+  if(stock){
+    // The Adafruit_ImageReader renderer the streamer replaced, for comparison
+    start = millis();
+    for(uint8_t i=0;i<frameRepeats;i++){
+      TEST_ASSERT_EQUAL(IMAGE_SUCCESS,reader.drawBMP(path,tft,0,0));
+    }
+    sprintf(label,"drawbmp_stock_%s",name);
+    report(label,(millis()-start)/frameRepeats,"ms");
+  }
+}
+
+void test_frame_draw(){
+  char path[40];
+  char name[24];
+  for(const BenchImage &image : benchImages){
+    benchImagePath(path,image,".bmp");
+    if(!SD.exists(path)){
+      TEST_ASSERT_TRUE_MESSAGE(writeBenchBmp(path,image),path);
+    }
+    sprintf(name,"%ux%u_%u",image.width,image.height,image.depth);
+    benchPicture(path,name,true);
+  }
+}
+
+void test_frame_draw_565(){
+  char path[40];
+  char name[24];
+  convertImagesTo565(ctx,benchDir);
+  for(const BenchImage &image : benchImages){
+    if(image.depth!=24){
+      continue; // The cached copy is the same whatever the source depth
+    }
+    benchImagePath(path,image,".565");
+    sprintf(name,"%ux%u_565",image.width,image.height);
+    benchPicture(path,name,false);
+  }
+}
+
+// 1 and 4 bit pictures whose rows don't end on a byte, each row has to be
+// found at its padded offset and match the palette colors it was written with
+static const BenchImage oddImages[] = {
+  {9,7,4}, {35,6,1}, {237,5,4},
+};
+
+void test_odd_width_palette(){
+  char path[40];
+  for(const BenchImage &image : oddImages){
+    benchImagePath(path,image,".bmp");
+    TEST_ASSERT_TRUE_MESSAGE(writeBenchBmp(path,image),path);
+    File32 file = SD.open(path);
+    TEST_ASSERT_TRUE_MESSAGE(file,path);
+    BmpHeader header;
+    BmpLayout layout;
+    TEST_ASSERT_EQUAL(IMAGE_SUCCESS,readBmpHeader(file,header));
+    TEST_ASSERT_EQUAL_UINT32(((uint32_t)image.width*image.depth+31)/32*4,header.rowSize);
+    TEST_ASSERT_TRUE(layoutBmp(ctx,header,0,0,layout));
+    TEST_ASSERT_EQUAL_UINT16(image.width,layout.width);
+    uint16_t colors = 1<<image.depth;
+    for(uint16_t row=0;row<image.height;row++){
+      TEST_ASSERT_EQUAL_UINT16(1,readBmpRows(file,header,layout,row,1,rowPixels));
+      uint16_t fileRow = image.height-1-row; // Written bottom up
+      for(uint16_t x=0;x<image.width;x++){
+        uint8_t bgra[4];
+        benchPaletteColor(benchPaletteIndex(x,fileRow,image.depth),colors,bgra);
+        uint16_t expected = ((bgra[2] & 0xF8) << 8) | ((bgra[1] & 0xFC) << 3) | (bgra[0] >> 3);
+        TEST_ASSERT_EQUAL_HEX16_MESSAGE(expected,rowPixels[x],path);
+      }
+    }
+    TEST_ASSERT_EQUAL(IMAGE_SUCCESS,drawBmp(ctx,file,0,0));
+    file.close();
+  }
+}
+
+// Pictures bigger than the screen, cropped to the top left corner and shrunk
+// to fit. Both should take about as long as a screen sized picture.
+void test_oversized_draw(){
+  char path[40];
+  char label[40];
+  const BenchImage oversized[] = {{480,640,24},{480,640,8}};
+  for(const BenchImage &image : oversized){
+    benchImagePath(path,image,".bmp");
+    if(!SD.exists(path)){
+      TEST_ASSERT_TRUE_MESSAGE(writeBenchBmp(path,image),path);
+    }
+    File32 file = SD.open(path);
+    TEST_ASSERT_TRUE_MESSAGE(file,path);
+
+    workReset();
+    uint32_t start = millis();
+    for(uint8_t i=0;i<frameRepeats;i++){
+      TEST_ASSERT_EQUAL(IMAGE_SUCCESS,drawBmp(ctx,file,0,0));
+    }
+    sprintf(label,"crop_%ux%u_%u",image.width,image.height,image.depth);
+    report(label,(millis()-start)/frameRepeats,"ms");
+
+    start = millis();
+    for(uint8_t i=0;i<frameRepeats;i++){
+      TEST_ASSERT_EQUAL(IMAGE_SUCCESS,drawBmpCentered(ctx,file));
+    }
+    sprintf(label,"scaled_%ux%u_%u",image.width,image.height,image.depth);
+    report(label,(millis()-start)/frameRepeats,"ms");
+    file.close();
+
+    // The biggest pictures still have to give the system a turn in time
+    sprintf(label,"yield_gap_%ux%u_%u",image.width,image.height,image.depth);
+    report(label,workLongestGap(),"us");
+    TEST_ASSERT_LESS_THAN_UINT32(workGapWarning,workLongestGap());
+  }
+}
+
+// Decode plus draw time and bytes read of the JPEGs in /bench/, to compare
+// with the BMPs of the same size
+void test_jpeg_draw(){
+  char name[40];
+  char label[56];
+  File32 dir = SD.open(benchDir);
+  TEST_ASSERT_TRUE(dir);
+  File32 entry = dir.openNextFile();
+  while(entry){
+    entry.getName(name,sizeof(name));
+    if(hasExtension(name,".jpg")){
+      uint32_t start = millis();
+      for(uint8_t i=0;i<frameRepeats;i++){
+        TEST_ASSERT_EQUAL(IMAGE_SUCCESS,drawJpegCentered(ctx,entry,BLACK));
+      }
+      sprintf(label,"jpeg_%s",name);
+      report(label,(millis()-start)/frameRepeats,"ms");
+      sprintf(label,"bytes_jpeg_%s",name);
+      report(label,jpegBytesRead(),"B");
+    }
+    entry.close();
+    entry = dir.openNextFile();
+  }
+  dir.close();
+  jpegRelease();
+}
+
+void test_sprite_blit(){
+  char path[40];
+  const BenchImage sprite = {32,32,24};
+  benchImagePath(path,sprite,".bmp");
+  if(!SD.exists(path)){
+    TEST_ASSERT_TRUE(writeBenchBmp(path,sprite));
+  }
+  SpriteCache sprites;
+  int8_t id = sprites.load(ctx,path);
+  TEST_ASSERT_NOT_EQUAL(-1,id);
+
+  uint32_t start = micros();
+  for(uint16_t i=0;i<spriteBlits;i++){
+    sprites.draw(ctx,id,(i*37)%(ctx.width-sprite.width),(i*53)%(ctx.length-sprite.height));
+  }
+  uint32_t elapsed = micros()-start;
+  report("sprite_blit_32x32",(uint64_t)spriteBlits*1000000/elapsed,"sprites/s");
+  report("sprite_blit_32x32_pixels",(uint64_t)spriteBlits*sprite.width*sprite.height*1000/elapsed,"kpx/s");
+}
+
+void test_fill_rect(){
+  uint32_t start = micros();
+  for(uint8_t i=0;i<fillRepeats;i++){
+    tft.fillRect(0,0,ctx.width,ctx.length,i&1 ? WHITE : BLACK);
+  }
+  uint32_t elapsed = micros()-start;
+  report("fillrect_full",(uint64_t)fillRepeats*ctx.width*ctx.length*1000/elapsed,"kpx/s");
+
+  const uint16_t smallRects = 500;
+  start = micros();
+  for(uint16_t i=0;i<smallRects;i++){
+    tft.fillRect((i*37)%(ctx.width-16),(i*53)%(ctx.length-16),16,16,i);
+  }
+  elapsed = micros()-start;
+  report("fillrect_16x16",(uint64_t)smallRects*1000000/elapsed,"rects/s");
+}
+
+void test_sd_sequential_read(){
+  File32 file;
+  if(!SD.exists(seqPath)){
+    file = SD.open(seqPath,O_WRONLY|O_CREAT|O_TRUNC);
+    TEST_ASSERT_TRUE(file);
+    for(uint32_t i=0;i<sizeof(benchBlock);i++){
+      benchBlock[i] = i;
+    }
+    for(uint32_t written=0;written<seqFileBytes;written+=sizeof(benchBlock)){
+      TEST_ASSERT_EQUAL(sizeof(benchBlock),file.write(benchBlock,sizeof(benchBlock)));
+    }
+    file.close();
+  }
+  file = SD.open(seqPath);
+  TEST_ASSERT_TRUE(file);
+  uint32_t bytes = 0;
+  uint32_t start = micros();
+  int got;
+  while((got = file.read(benchBlock,sizeof(benchBlock)))>0){
+    bytes += got;
+  }
+  uint32_t elapsed = micros()-start;
+  file.close();
+  TEST_ASSERT_EQUAL(seqFileBytes,bytes);
+  report("sd_seq_read_4k",(uint64_t)bytes*1000/elapsed,"KB/s");
+}
+
+void test_directory_scan(){
+  char path[40];
+  if(!SD.exists(scanDir)){
+    TEST_ASSERT_TRUE(SD.mkdir(scanDir));
+    for(uint16_t i=0;i<scanFiles;i++){
+      sprintf(path,"%sfile%03u.bmp",scanDir,i);
+      File32 file = SD.open(path,O_WRONLY|O_CREAT|O_TRUNC);
+      TEST_ASSERT_TRUE(file);
+      file.close();
+    }
+  }
+
+  uint32_t start = micros();
+  File32 dir = SD.open(scanDir);
+  TEST_ASSERT_TRUE(dir);
+  uint16_t found = 0;
+  File32 entry = dir.openNextFile();
+  while(entry){
+    entry.getName(path,sizeof(path));
+    if(hasExtension(path,".bmp")){
+      found++;
+    }
+    entry.close();
+    entry = dir.openNextFile();
+  }
+  dir.close();
+  uint32_t elapsed = micros()-start;
+  TEST_ASSERT_EQUAL(scanFiles,found);
+  sprintf(path,"dir_scan_%u",scanFiles);
+  report(path,elapsed,"us");
+}
+
+// Per-call overhead of the old by-value display parameter against the
+// render context reference
+__attribute__((noinline)) int16_t byValueCall(Adafruit_ILI9341 copy){
+  return copy.width();
+}
+__attribute__((noinline)) int16_t byReferenceCall(RenderContext &ctx){
+  return ctx.tft.width();
+}
+void test_render_call(){
+  const uint16_t iterations = 1000;
+  volatile int32_t sink = 0; // Keeps the calls from being optimized away
+
+  uint32_t start = micros();
+  for(uint16_t i=0;i<iterations;i++){
+    sink += byValueCall(ctx.tft);
+  }
+  report("call_by_value_1000",micros()-start,"us");
+
+  start = micros();
+  for(uint16_t i=0;i<iterations;i++){
+    sink += byReferenceCall(ctx);
+  }
+  report("call_by_reference_1000",micros()-start,"us");
+}
+
+void setup() {
+  delay(2000); // Lets the test runner open the serial port
+
+  Serial.begin(115200);
+  uint8_t tftMHz = calibrateTftClock(tft);
+  uint8_t sdMHz  = calibrateSdClock(SD, SD_CS);
+  Serial.printf("BENCH_INFO,core,%s\n",ESP.getCoreVersion().c_str());
+  Serial.printf("BENCH_INFO,sdk,%s\n",ESP.getSdkVersion());
+  Serial.printf("BENCH_INFO,cpu,%u,MHz\n",ESP.getCpuFreqMHz());
+  Serial.printf("BENCH_INFO,tft_clock,%u,MHz\n",tftMHz);
+  Serial.printf("BENCH_INFO,sd_clock,%u,MHz\n",sdMHz);
+
+  UNITY_BEGIN();
+  RUN_TEST(test_render_call);
+  RUN_TEST(test_fill_rect);
+  if(sdMHz&&(SD.exists(benchDir)||SD.mkdir(benchDir))){
+    RUN_TEST(test_frame_draw);
+    RUN_TEST(test_odd_width_palette);
+    RUN_TEST(test_oversized_draw);
+    RUN_TEST(test_frame_draw_565);
+    RUN_TEST(test_jpeg_draw);
+    RUN_TEST(test_sprite_blit);
+    RUN_TEST(test_sd_sequential_read);
+    RUN_TEST(test_directory_scan);
+  }else{
+    Serial.println(F("No SD card, skipping the card benchmarks"));
+  }
+  UNITY_END();
+}
+
+void loop() {
+}
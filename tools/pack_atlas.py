@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+"""Packs the sprites of a folder into one atlas file for the display.
+
+Usage: python tools/pack_atlas.py <folder> [output] [--max-size N]
+
+Every image of the folder (BMP, PNG, anything Pillow opens) up to
+max-size pixels on each side becomes one sprite, named after its file
+without the extension. Larger images, like the pattern message that is
+read back from the card by the compositor, are left out. The output
+defaults to <folder>/sprites.atl, copy it to the same place on the SD
+card. The format is described in include/SpriteCache.h.
+"""
+
+import argparse
+import os
+import struct
+import sys
+
+from PIL import Image
+
+ATLAS_MAGIC = b"SATL"
+NAME_LENGTH = 16
+MAX_SPRITES = 8  # SpriteCache::maxSprites
+
+
+def rgb565(r, g, b):
+    return ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Pack sprites into an atlas file")
+    parser.add_argument("folder")
+    parser.add_argument("output", nargs="?")
+    parser.add_argument("--max-size", type=int, default=64,
+                        help="largest sprite width or height to pack (default 64)")
+    args = parser.parse_args()
+    output = args.output or os.path.join(args.folder, "sprites.atl")
+
+    sprites = []
+    for filename in sorted(os.listdir(args.folder)):
+        path = os.path.join(args.folder, filename)
+        if not os.path.isfile(path) or os.path.abspath(path) == os.path.abspath(output):
+            continue
+        try:
+            image = Image.open(path).convert("RGB")
+        except OSError:
+            continue  # Not an image
+        name = os.path.splitext(filename)[0]
+        if image.width > args.max_size or image.height > args.max_size:
+            print(f"skipping {filename}, {image.width}x{image.height} is larger than {args.max_size}")
+            continue
+        if len(name.encode()) >= NAME_LENGTH:
+            sys.exit(f"{filename}: names are limited to {NAME_LENGTH - 1} characters")
+        pixels = b"".join(struct.pack("<H", rgb565(*p)) for p in image.getdata())
+        sprites.append((name, image.width, image.height, pixels))
+        print(f"packed {name} {image.width}x{image.height}")
+
+    if not sprites:
+        sys.exit("no sprites found")
+    if len(sprites) > MAX_SPRITES:
+        sys.exit(f"{len(sprites)} sprites, the display caches {MAX_SPRITES} at most")
+
+    with open(output, "wb") as atlas:
+        atlas.write(ATLAS_MAGIC + struct.pack("<HH", len(sprites), 0))
+        for name, width, height, _ in sprites:
+            atlas.write(name.encode().ljust(NAME_LENGTH, b"\0") + struct.pack("<HH", width, height))
+        for *_, pixels in sprites:
+            atlas.write(pixels)
+    print(f"wrote {output}, {len(sprites)} sprites, {os.path.getsize(output)} bytes")
+
+
+if __name__ == "__main__":
+    main()